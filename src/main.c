@@ -5,17 +5,32 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <termios.h>
 #include <time.h>
 #include <sys/resource.h>
 #include <sys/time.h>
 #include <sys/select.h>
+#include <sys/stat.h>
 #include <pthread.h>
-//#include <omp.h>
+#include <zlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PIXEL_SPAN_X86_DISPATCH  // AVX2/AVX-512 pixel conversion, chosen at run time
+#endif
+#include <stdatomic.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "../include/stb/stb_image.h"
 #include "../include/stb/stb_image_write.h"
 #include "../include/stb/stb_truetype.h"
@@ -35,11 +50,67 @@ unsigned char ttf_buffer[1<<20];
 stbtt_fontinfo font;
 
 // Prototypes
+// Packed 8-bit-per-channel pixel: RGBA-style layout with the luma in the spare byte
 typedef struct {
-    int gray_value;
-    int r, g, b;
+    uint8_t r, g, b;
+    uint8_t gray_value;
 } CachedPixel;
 
+_Static_assert(sizeof(CachedPixel) == 4, "CachedPixel must stay packed into 4 bytes");
+
+// Foreground or background colour of a character cell
+typedef struct {
+    uint8_t r, g, b;
+} CellColor;
+
+// One character cell: glyph index into the grid's character set, drawn in fg
+typedef struct {
+    uint8_t glyph;
+    CellColor fg;
+} Cell;
+
+// Character grid of one frame or image at one geometry. It is computed once, with the glyph mapping applied, and
+// every output (terminal, TXT, PNG) serializes it. bg is NULL when every cell sits on the black background.
+typedef struct {
+    Cell *cells;
+    CellColor *bg;
+    int width, height;
+    size_t capacity;  // Cells allocated
+    const char *char_set;
+    int char_set_size;
+} CellGrid;
+
+// Fixed-point BT.601 luma. The weights are 0.299, 0.587 and 0.114 scaled by 2^15; they sum to exactly 2^15 so
+// white stays 255, and fit the signed 16-bit multiplies the SIMD conversions use.
+#define LUMA_WEIGHT_R 9798
+#define LUMA_WEIGHT_G 19235
+#define LUMA_WEIGHT_B 3735
+#define LUMA_SHIFT 15
+
+static inline uint8_t luma_from_rgb(int r, int g, int b) {
+    return (uint8_t)((LUMA_WEIGHT_R * r + LUMA_WEIGHT_G * g + LUMA_WEIGHT_B * b) >> LUMA_SHIFT);
+}
+
+#define CACHE_LINE_SIZE 64
+#define CACHE_PARALLEL_MIN_PIXELS (256 * 1024)  // Below this, waking threads costs more than converting serially
+
+// Threads converting large images to CachedPixel and drawing large PNG canvases; 0 uses the OpenMP default (OMP_NUM_THREADS or one per CPU)
+#ifndef CACHE_THREADS
+#define CACHE_THREADS 0
+#endif
+int cache_thread_count = CACHE_THREADS;
+
+// Image formats the file output mode writes (--format); indexes image_encoders
+typedef enum { OUTPUT_PNG, OUTPUT_PPM, OUTPUT_BMP, OUTPUT_QOI, OUTPUT_JPEG } OutputFormat;
+
+OutputFormat output_format = OUTPUT_PNG;
+int png_compression_level = 6;  // zlib level, 0-9
+int jpeg_quality = 90;          // 1-100
+
+#define RASTER_PARALLEL_MIN_PIXELS (512 * 1024)  // PNG bands below this are drawn on the calling thread
+#define RASTER_BAND_BYTES (16 << 20)  // PNG output is drawn and encoded this much at a time (at least one cell row)
+#define OUTPUT_MAX_DIMENSION (1 << 24)  // Largest PNG side in pixels
+
 void get_terminal_size(int *rows, int *cols);
 
 // Default ASCII character set
@@ -57,6 +128,10 @@ int block_map_size = 8;
 // Constants for buffering
 #define BUFFER_POOL_SIZE 15
 
+// Fast-start probing limits (FFmpeg defaults are 5 MB / 5 seconds)
+#define FAST_START_PROBESIZE (256 * 1024)     // Bytes read while probing the container
+#define FAST_START_ANALYZE_DURATION 500000    // Microseconds of stream analysed for codec parameters
+
 #define NUM_PRODUCERS 1
 
 AVFrame *frame_pool[NUM_PRODUCERS][BUFFER_POOL_SIZE];
@@ -72,7 +147,9 @@ CachedPixel *cached_image_pool[NUM_PRODUCERS][BUFFER_POOL_SIZE];
 typedef struct {
     AVFrame *frame;
     CachedPixel *cached_img;
+    int grid_width, grid_height;  // Character grid the producer reduced the frame to; 0 if cached_img holds the whole frame
     int is_ready;
+    int generation;  // Playback generation the frame was decoded in; stale frames are dropped after a seek
 } FrameBuffer;
 
 #define NUM_BUFFERS 2  // Number of buffers for double buffering
@@ -80,6 +157,7 @@ FrameBuffer frame_buffer[NUM_BUFFERS][BUFFER_POOL_SIZE];
 
 int buffer_write_index = 0;
 int buffer_read_index = 0;
+int frames_released = 0;  // Frames the consumer has taken out of the ring, in order; guarded by buffer_mutex
 
 // Struct for passing arguments to the producer thread
 typedef struct {
@@ -87,6 +165,7 @@ typedef struct {
     AVCodecContext *pCodecContext;
     int video_stream_index;
     int producer_id;  // New field to identify the producer
+    double fps;       // Source frame rate, used to skip frames that will not be shown at high speeds
 } ProducerArgs;
 
 // Struct for passing arguments to the consumer thread
@@ -94,12 +173,54 @@ typedef struct {
     int pCodecContext_width;
     int pCodecContext_height;
     double fps;
+    AVRational time_base;  // Video stream time base, for turning frame timestamps into seconds
+    int64_t start_time;    // Video stream start time in time_base units
+    bool seekable;         // The producer handles seek_requested; image sequence workers do not
 } ConsumerArgs;
 
+// Sidecar index written next to a video as <input>.a2aidx, so later opens and seeks skip probing
+#define SIDECAR_INDEX_MAGIC "A2AIDX\0\0"
+#define SIDECAR_INDEX_VERSION 1
+#define SIDECAR_INDEX_SUFFIX ".a2aidx"
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    int64_t file_size;       // Size of the indexed input, used for validation
+    int64_t file_mtime;      // Modification time of the indexed input, used for validation
+    char format_name[32];    // Demuxer short name, passed to avformat_open_input to skip format probing
+    int32_t stream_index;
+    int32_t codec_id;
+    int32_t pix_fmt;
+    int32_t width, height;
+    int32_t time_base_num, time_base_den;
+    int32_t frame_rate_num, frame_rate_den;
+    int64_t start_time;      // Stream start time in time_base units
+    uint32_t keyframe_count;
+    uint32_t frame_count;
+} SidecarIndexHeader;
+
+typedef struct {
+    int64_t pts;  // Presentation timestamp in stream time_base units
+    int64_t pos;  // Byte offset of the keyframe packet in the input
+} IndexKeyframe;
+
+typedef struct {
+    SidecarIndexHeader header;
+    IndexKeyframe *keyframes;
+    uint32_t *frame_sizes;   // Compressed size of every video packet, in decode order
+    uint32_t keyframe_capacity;
+    uint32_t frame_capacity;
+    bool is_loaded;          // Loaded from a valid sidecar (as opposed to being built during playback)
+} SidecarIndex;
+
 typedef struct {
     bool has_fps_info;  // Flag indicating if FPS info is available
     double avg_fps;     // Average FPS
     double avg_frame_delay; // Average frame delay in milliseconds
+    bool has_latency;   // Flag indicating if input-to-display latency is available (live mode)
+    double latency_ms;  // Input-to-display latency of the previously shown frame in milliseconds
 } DebugInfo;
 
 // Synchronization primitives
@@ -112,6 +233,152 @@ pthread_cond_t buffer_cond = PTHREAD_COND_INITIALIZER;
 volatile bool is_running = true;
 volatile bool is_done = false; // Added to indicate that producer is done
 
+// Seeking: the consumer posts a request, the producer performs it and bumps the playback generation
+#define SEEK_STEP_SECONDS 10.0
+volatile bool seek_requested = false;
+volatile double seek_target_seconds = 0.0;
+int playback_generation = 0;  // Protected by buffer_mutex
+
+// Live mode: latest-frame-wins triple buffer instead of the queued ring. The producer fills its back slot and
+// swaps it into the middle; the consumer swaps the middle out only when it holds a frame it has not seen yet.
+#define LIVE_SLOT_FRESH 0x4          // Set in live_middle_slot while the middle slot holds an unseen frame
+#define LIVE_PROBESIZE 32768         // Bytes read while probing a live source
+#define LIVE_PACKET_TIME_HISTORY 32  // Packet read times kept for matching decoded frames
+#define LIVE_IDLE_POLL_US 1000       // How long the consumer waits for input between checks for a new frame
+
+bool live_mode = false;
+atomic_int live_middle_slot = 2;
+int live_back_slot = 0;              // Owned by the producer
+int live_front_slot = 1;             // Owned by the consumer
+struct timespec live_input_time[3];  // When the packet behind each slot's frame was read
+int live_grid_width[3], live_grid_height[3];  // Character grid of each slot's frame, as in FrameBuffer
+int live_published_count = 0;
+int live_overwritten_count = 0;      // Frames replaced before the consumer took them
+double live_latency_total = 0.0;
+double live_latency_max = 0.0;
+
+// Region of interest for crop/zoom/pan, normalized to the source size; {0, 0, 1, 1} is the whole image
+typedef struct {
+    double x, y;
+    double width, height;
+} ViewRegion;
+
+typedef struct {
+    int x, y;
+    int width, height;
+} PixelRect;
+
+#define VIEW_ZOOM_STEP 1.25
+#define VIEW_PAN_STEP 0.1    // Fraction of the visible region moved per pan key
+#define VIEW_MIN_SIZE 0.01   // Smallest region, as a fraction of the source
+
+ViewRegion view_region = {0.0, 0.0, 1.0, 1.0};
+int view_generation = 0;     // Bumped on every view change, protected by view_mutex
+pthread_mutex_t view_mutex = PTHREAD_MUTEX_INITIALIZER;
+PixelRect initial_crop = {0, 0, 0, 0};  // --crop geometry in source pixels, applied once the source size is known
+
+// Playback speed: scales the consumer's presentation clock; the producer skips frames that will not be shown
+#define MIN_PLAYBACK_SPEED 0.25
+#define MAX_PLAYBACK_SPEED 8.0
+const double playback_speed_steps[] = {0.25, 0.5, 0.75, 1.0, 1.25, 1.5, 2.0, 3.0, 4.0, 6.0, 8.0};
+#define NUM_PLAYBACK_SPEED_STEPS (int)(sizeof(playback_speed_steps) / sizeof(playback_speed_steps[0]))
+volatile double playback_speed = 1.0;
+int producer_skipped_frame_count = 0;  // Decoded frames never converted because they would not be shown
+int consumer_dropped_frame_count = 0;  // Converted frames dropped because they arrived too late
+
+// Loop mode: the first pass keeps each frame's render grid so later passes replay without decoding
+#define LOOP_CACHE_DEFAULT_BUDGET_MB 256
+
+// stb decodes every frame of a GIF at full size before any is reduced; larger animations show their first frame
+#define GIF_DECODE_MAX_BYTES ((uint64_t)1024 * 1024 * 1024)
+
+typedef struct {
+    CachedPixel *cells;  // One pixel per character cell, as sampled for the terminal
+    int width, height;   // Grid size in cells
+    int img_width, img_height;  // Size of the frame the grid was sampled from
+    int64_t pts;         // Frame timestamp in stream time_base units
+    double duration;     // How long the frame stays on screen at 1x, in seconds
+} LoopCacheFrame;
+
+bool loop_playback = false;
+size_t loop_cache_budget = (size_t)LOOP_CACHE_DEFAULT_BUDGET_MB * 1024 * 1024;
+LoopCacheFrame *loop_cache_frames = NULL;
+int loop_cache_count = 0;
+int loop_cache_capacity = 0;
+size_t loop_cache_bytes = 0;
+bool loop_cache_valid = true;          // Cleared when the first pass overflows the budget or is interrupted by a seek
+int loop_replayed_frame_count = 0;
+volatile bool producer_at_eof = false; // Loop mode: producer reached EOF and waits to be rewound or released
+volatile bool loop_cache_playing = false;
+
+// Non-seekable input (stdin or a named pipe) read through a custom AVIOContext. The bytes read up front
+// to probe the content type are replayed to the demuxer before the pipe is read any further.
+#define STREAM_PROBE_SIZE (64 * 1024)        // Bytes read from a pipe to probe its content type
+#define STREAM_AVIO_BUFFER_SIZE (64 * 1024)  // Read buffer handed to the custom AVIOContext
+
+typedef struct {
+    int fd;                 // Descriptor the stream is read from, -1 when the input is a regular file
+    uint8_t *probe_data;    // First bytes of the stream, followed by AVPROBE_PADDING_SIZE zero bytes
+    size_t probe_size;
+    size_t probe_offset;    // How much of probe_data has been replayed to the demuxer
+    AVIOContext *avio;
+} StreamInput;
+
+StreamInput stream_input = {.fd = -1};
+
+// Image sequence input (frame_%05d.png). Worker threads decode frames out of order with stb; frame n always lands
+// in ring position n, so the ring itself is the reorder buffer and the consumer receives frames in sequence.
+#define SEQUENCE_MAX_WORKERS 16
+#define SEQUENCE_START_SEARCH 5   // Frame numbers tried when looking for the first file of a sequence
+#define SEQUENCE_DEFAULT_FPS 25.0
+
+typedef struct {
+    const char *pattern;  // printf pattern with one integer conversion
+    int first_number;     // Number in the first file name
+    int frame_count;
+    double fps;
+} ImageSequence;
+
+ImageSequence image_sequence;
+double sequence_fps = SEQUENCE_DEFAULT_FPS;
+int sequence_worker_count = 0;           // 0 uses one worker per online CPU
+atomic_int sequence_next_frame = 0;      // Next frame a worker claims
+int sequence_workers_running = 0;        // Guarded by buffer_mutex; the last worker to finish sets is_done
+size_t sequence_slot_bytes[BUFFER_POOL_SIZE];  // Allocated size of each cached image pool slot
+
+// Still images over this many pixels are reduced while decoding instead of being held at full resolution
+#define STILL_IMAGE_PIXEL_BUDGET ((uint64_t)16 * 1024 * 1024)
+
+// Terminal renders of still images over this many pixels paint a quick preview while the full image decodes
+#define PREVIEW_MIN_PIXELS ((uint64_t)4 * 1024 * 1024)
+#define PREVIEW_MAX_DIMENSION 512  // Long side of a sparse-sampled raster preview
+#define PREVIEW_JPEG_LOWRES 3      // 1/8 scale, decoded from the DCT DC coefficients
+#define JPEG_MAX_LOWRES 3          // The MJPEG decoder scales by 1/2, 1/4 or 1/8 in the IDCT
+
+int image_decode_lowres = 0;  // Power-of-two downscale requested from decoders that support it (JPEG)
+
+// Uncompressed raster file (binary PGM/PPM or BMP) whose rows can be read a strip at a time
+typedef struct {
+    FILE *file;
+    int width, height;
+    int bytes_per_pixel;  // 1 (gray), 3 or 4
+    bool bgr;             // BMP stores blue first
+    bool bottom_up;       // BMP rows usually run from the bottom of the image up
+    int64_t data_offset;  // File offset of the first stored row
+    int64_t row_stride;   // Bytes per stored row, including padding
+} RasterFile;
+
+// Raw frames have no header to probe, so their geometry comes from the command line
+const char *raw_video_size = NULL;     // WxH; set to read the input as rawvideo
+const char *raw_pixel_format = "rgb24";
+const char *raw_frame_rate = "25";
+
+// Sidecar index state for the current video
+bool use_sidecar_index = true;
+SidecarIndex sidecar_index;
+volatile bool index_recording = false;     // Producer is recording packets to build a new index
+volatile bool index_pass_complete = false; // Recording reached EOF without seeking, so the index covers the whole file
+
 // Profiling variables
 struct timespec producer_start_time, producer_end_time;
 double producer_total_time = 0.0;
@@ -122,6 +389,11 @@ double producer_convert_frame_total_time = 0.0;
 double producer_cache_total_time = 0.0;
 int producer_frame_count = 0;
 
+// Startup profiling: time from process start to the first byte of rendered output, less time spent at prompts
+struct timespec process_start_time, first_output_time;
+bool first_output_recorded = false;
+double prompt_wait_time = 0.0;
+
 struct timespec consumer_start_time, consumer_end_time;
 double consumer_total_time = 0.0;
 double consumer_lock_wait_total = 0.0;
@@ -129,6 +401,94 @@ double consumer_render_total = 0.0;
 double consumer_buffer_update_total = 0.0;
 int consumer_frame_count = 0;
 
+void clamp_view_region(ViewRegion *view) {
+    view->width = view->width < VIEW_MIN_SIZE ? VIEW_MIN_SIZE : (view->width > 1.0 ? 1.0 : view->width);
+    view->height = view->height < VIEW_MIN_SIZE ? VIEW_MIN_SIZE : (view->height > 1.0 ? 1.0 : view->height);
+    view->x = view->x < 0.0 ? 0.0 : (view->x > 1.0 - view->width ? 1.0 - view->width : view->x);
+    view->y = view->y < 0.0 ? 0.0 : (view->y > 1.0 - view->height ? 1.0 - view->height : view->y);
+}
+
+ViewRegion get_view_region(int *generation) {
+    pthread_mutex_lock(&view_mutex);
+    ViewRegion view = view_region;
+    if (generation) {
+        *generation = view_generation;
+    }
+    pthread_mutex_unlock(&view_mutex);
+    return view;
+}
+
+void set_view_region(ViewRegion view) {
+    clamp_view_region(&view);
+    pthread_mutex_lock(&view_mutex);
+    view_region = view;
+    view_generation++;
+    pthread_mutex_unlock(&view_mutex);
+}
+
+// Apply an interactive view key (i/o zoom, h/j/k/l pan, 0 reset); returns true if the key changed the view
+bool handle_view_key(char key) {
+    ViewRegion view = get_view_region(NULL);
+    double center_x = view.x + view.width / 2;
+    double center_y = view.y + view.height / 2;
+
+    switch (key) {
+        case 'i':
+        case 'o': {
+            double factor = key == 'i' ? 1.0 / VIEW_ZOOM_STEP : VIEW_ZOOM_STEP;
+            view.width *= factor;
+            view.height *= factor;
+            view.x = center_x - view.width / 2;
+            view.y = center_y - view.height / 2;
+            break;
+        }
+        case 'h': view.x -= view.width * VIEW_PAN_STEP; break;
+        case 'l': view.x += view.width * VIEW_PAN_STEP; break;
+        case 'k': view.y -= view.height * VIEW_PAN_STEP; break;
+        case 'j': view.y += view.height * VIEW_PAN_STEP; break;
+        case '0': view = (ViewRegion){0.0, 0.0, 1.0, 1.0}; break;
+        default:
+            return false;
+    }
+
+    set_view_region(view);
+    return true;
+}
+
+// Turn the --crop geometry into the normalized view once the source size is known
+void apply_initial_crop(int img_width, int img_height) {
+    if (initial_crop.width <= 0 || initial_crop.height <= 0 || img_width <= 0 || img_height <= 0) {
+        return;
+    }
+    set_view_region((ViewRegion){(double)initial_crop.x / img_width, (double)initial_crop.y / img_height,
+                                 (double)initial_crop.width / img_width, (double)initial_crop.height / img_height});
+}
+
+// Convert the view to a pixel rectangle; x/y are aligned down to the chroma subsampling so every plane starts on a sample
+void view_region_to_rect(const ViewRegion *view, int img_width, int img_height, int log2_align_x, int log2_align_y, PixelRect *rect) {
+    rect->x = ((int)(view->x * img_width) >> log2_align_x) << log2_align_x;
+    rect->y = ((int)(view->y * img_height) >> log2_align_y) << log2_align_y;
+    rect->width = (int)(view->width * img_width + 0.5);
+    rect->height = (int)(view->height * img_height + 0.5);
+
+    if (rect->width < 1) rect->width = 1;
+    if (rect->height < 1) rect->height = 1;
+    if (rect->x + rect->width > img_width) rect->width = img_width - rect->x;
+    if (rect->y + rect->height > img_height) rect->height = img_height - rect->y;
+}
+
+// Step the playback speed up or down through playback_speed_steps
+void change_playback_speed(int direction) {
+    int step = 0;
+    while (step < NUM_PLAYBACK_SPEED_STEPS - 1 && playback_speed_steps[step] < playback_speed) {
+        step++;
+    }
+    step += direction;
+    if (step >= 0 && step < NUM_PLAYBACK_SPEED_STEPS) {
+        playback_speed = playback_speed_steps[step];
+    }
+}
+
 // Function to get a formatted timestamp
 void print_timestamp(const char *message) {
     struct timeval tv;
@@ -137,6 +497,36 @@ void print_timestamp(const char *message) {
     fflush(stdout);
 }
 
+// Record the moment the first rendered frame starts being written out
+void mark_first_output() {
+    if (!first_output_recorded) {
+        clock_gettime(CLOCK_MONOTONIC, &first_output_time);
+        first_output_recorded = true;
+    }
+}
+
+// Read a line of input for a prompt; time spent waiting before the first output is left out of time to first frame
+char *read_prompt_input(char *buffer, int size) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    char *line = fgets(buffer, size, stdin);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (!first_output_recorded) {
+        prompt_wait_time += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    }
+    return line;
+}
+
+void print_time_to_first_frame() {
+    if (first_output_recorded) {
+        double ttff = (first_output_time.tv_sec - process_start_time.tv_sec) + (first_output_time.tv_nsec - process_start_time.tv_nsec) / 1e9 -
+                      prompt_wait_time;
+        printf("Time to First Frame: %.2f ms\n", ttff * 1000.0);
+    } else {
+        printf("Time to First Frame: n/a (nothing rendered)\n");
+    }
+}
+
 int init_font(const char *font_path) {
     print_timestamp("Initializing font...");
     FILE *font_file = fopen(font_path, "rb");
@@ -151,24 +541,424 @@ int init_font(const char *font_path) {
     return 0;
 }
 
-int init_ffmpeg(const char *filename, AVFormatContext **pFormatContext, AVCodecContext **pCodecContext, int *video_stream_index) {
-    // Initialize FFmpeg and open the input video file
-    avformat_network_init();
-    print_timestamp("Initializing FFmpeg...");
+// Build the sidecar path for an input file: <input>.a2aidx
+void sidecar_index_path(const char *filename, char *index_path, size_t index_path_size) {
+    snprintf(index_path, index_path_size, "%s%s", filename, SIDECAR_INDEX_SUFFIX);
+}
 
-    if (avformat_open_input(pFormatContext, filename, NULL, NULL) != 0) {
-        fprintf(stderr, "Could not open video file: %s\n", filename);
+void sidecar_index_free(SidecarIndex *index) {
+    free(index->keyframes);
+    free(index->frame_sizes);
+    memset(index, 0, sizeof(*index));
+}
+
+// Load a sidecar index and check it still describes the input (same size and mtime)
+int sidecar_index_load(const char *filename, SidecarIndex *index) {
+    struct stat input_stat;
+    if (stat(filename, &input_stat) != 0) {
         return -1;
     }
 
-    if (avformat_find_stream_info(*pFormatContext, NULL) < 0) {
-        fprintf(stderr, "Could not find stream information.\n");
-        avformat_close_input(pFormatContext);
+    char index_path[4096];
+    sidecar_index_path(filename, index_path, sizeof(index_path));
+    FILE *file = fopen(index_path, "rb");
+    if (!file) {
+        return -1;
+    }
+
+    SidecarIndexHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, SIDECAR_INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != SIDECAR_INDEX_VERSION) {
+        fprintf(stderr, "Ignoring unreadable index: %s\n", index_path);
+        fclose(file);
+        return -1;
+    }
+
+    if (header.file_size != (int64_t)input_stat.st_size || header.file_mtime != (int64_t)input_stat.st_mtime) {
+        fprintf(stderr, "Ignoring stale index: %s\n", index_path);
+        fclose(file);
+        return -1;
+    }
+
+    IndexKeyframe *keyframes = malloc((size_t)header.keyframe_count * sizeof(IndexKeyframe) + 1);
+    uint32_t *frame_sizes = malloc((size_t)header.frame_count * sizeof(uint32_t) + 1);
+    if (!keyframes || !frame_sizes ||
+        fread(keyframes, sizeof(IndexKeyframe), header.keyframe_count, file) != header.keyframe_count ||
+        fread(frame_sizes, sizeof(uint32_t), header.frame_count, file) != header.frame_count) {
+        fprintf(stderr, "Ignoring truncated index: %s\n", index_path);
+        free(keyframes);
+        free(frame_sizes);
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+
+    sidecar_index_free(index);
+    index->header = header;
+    index->keyframes = keyframes;
+    index->frame_sizes = frame_sizes;
+    index->keyframe_capacity = header.keyframe_count;
+    index->frame_capacity = header.frame_count;
+    index->is_loaded = true;
+    return 0;
+}
+
+// Start a new index for the given input, recording the stream parameters that probing would otherwise discover
+int sidecar_index_begin(SidecarIndex *index, const char *filename, AVFormatContext *pFormatContext,
+                        AVCodecContext *pCodecContext, int video_stream_index) {
+    struct stat input_stat;
+    if (stat(filename, &input_stat) != 0) {
+        return -1;  // Not a regular file (e.g. a URL), nothing to validate against
+    }
+
+    sidecar_index_free(index);
+    SidecarIndexHeader *header = &index->header;
+    memcpy(header->magic, SIDECAR_INDEX_MAGIC, sizeof(header->magic));
+    header->version = SIDECAR_INDEX_VERSION;
+    header->file_size = input_stat.st_size;
+    header->file_mtime = input_stat.st_mtime;
+
+    // Only keep the first demuxer name, which is what av_find_input_format matches against
+    const char *format_name = pFormatContext->iformat->name;
+    size_t name_length = strcspn(format_name, ",");
+    if (name_length >= sizeof(header->format_name)) {
+        name_length = sizeof(header->format_name) - 1;
+    }
+    memcpy(header->format_name, format_name, name_length);
+
+    AVStream *stream = pFormatContext->streams[video_stream_index];
+    header->stream_index = video_stream_index;
+    header->codec_id = stream->codecpar->codec_id;
+    header->pix_fmt = pCodecContext->pix_fmt;
+    header->width = pCodecContext->width;
+    header->height = pCodecContext->height;
+    header->time_base_num = stream->time_base.num;
+    header->time_base_den = stream->time_base.den;
+    header->frame_rate_num = stream->r_frame_rate.num;
+    header->frame_rate_den = stream->r_frame_rate.den;
+    header->start_time = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    return 0;
+}
+
+// Record one video packet: its size, and its position if it starts a keyframe
+void sidecar_index_add_packet(SidecarIndex *index, const AVPacket *packet) {
+    if (index->header.frame_count == index->frame_capacity) {
+        uint32_t new_capacity = index->frame_capacity ? index->frame_capacity * 2 : 4096;
+        uint32_t *frame_sizes = realloc(index->frame_sizes, (size_t)new_capacity * sizeof(uint32_t));
+        if (!frame_sizes) {
+            return;
+        }
+        index->frame_sizes = frame_sizes;
+        index->frame_capacity = new_capacity;
+    }
+    index->frame_sizes[index->header.frame_count++] = packet->size;
+
+    if (packet->flags & AV_PKT_FLAG_KEY) {
+        if (index->header.keyframe_count == index->keyframe_capacity) {
+            uint32_t new_capacity = index->keyframe_capacity ? index->keyframe_capacity * 2 : 256;
+            IndexKeyframe *keyframes = realloc(index->keyframes, (size_t)new_capacity * sizeof(IndexKeyframe));
+            if (!keyframes) {
+                return;
+            }
+            index->keyframes = keyframes;
+            index->keyframe_capacity = new_capacity;
+        }
+        IndexKeyframe *keyframe = &index->keyframes[index->header.keyframe_count++];
+        keyframe->pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+        keyframe->pos = packet->pos;
+    }
+}
+
+int sidecar_index_write(const char *filename, const SidecarIndex *index) {
+    char index_path[4096];
+    sidecar_index_path(filename, index_path, sizeof(index_path));
+
+    FILE *file = fopen(index_path, "wb");
+    if (!file) {
+        fprintf(stderr, "Failed to create index file: %s\n", index_path);
+        return -1;
+    }
+
+    const SidecarIndexHeader *header = &index->header;
+    if (fwrite(header, sizeof(*header), 1, file) != 1 ||
+        fwrite(index->keyframes, sizeof(IndexKeyframe), header->keyframe_count, file) != header->keyframe_count ||
+        fwrite(index->frame_sizes, sizeof(uint32_t), header->frame_count, file) != header->frame_count) {
+        fprintf(stderr, "Failed to write index file: %s\n", index_path);
+        fclose(file);
+        remove(index_path);
+        return -1;
+    }
+
+    fclose(file);
+    return 0;
+}
+
+// Find the last indexed keyframe at or before target_pts (binary search, keyframes are in decode order)
+const IndexKeyframe *sidecar_index_find_keyframe(const SidecarIndex *index, int64_t target_pts) {
+    const IndexKeyframe *found = NULL;
+    uint32_t low = 0, high = index->header.keyframe_count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (index->keyframes[mid].pts <= target_pts) {
+            found = &index->keyframes[mid];
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return found;
+}
+
+// Apply stream parameters from a valid sidecar index so avformat_find_stream_info can be skipped
+bool apply_sidecar_index(AVFormatContext *pFormatContext, const SidecarIndex *index) {
+    const SidecarIndexHeader *header = &index->header;
+    if (header->stream_index < 0 || header->stream_index >= (int)pFormatContext->nb_streams) {
+        return false;
+    }
+
+    AVStream *stream = pFormatContext->streams[header->stream_index];
+    if (stream->codecpar->codec_type != AVMEDIA_TYPE_VIDEO || (int32_t)stream->codecpar->codec_id != header->codec_id) {
+        return false;
+    }
+
+    stream->codecpar->format = header->pix_fmt;
+    stream->codecpar->width = header->width;
+    stream->codecpar->height = header->height;
+    stream->r_frame_rate = (AVRational){header->frame_rate_num, header->frame_rate_den};
+    if (stream->avg_frame_rate.den == 0) {
+        stream->avg_frame_rate = stream->r_frame_rate;
+    }
+
+    // Fill in what probing would otherwise estimate: frame count, duration and bitrate from the recorded packet sizes
+    double frame_rate = av_q2d(stream->r_frame_rate);
+    if (header->frame_count > 0 && header->frame_rate_den > 0 && frame_rate > 0) {
+        uint64_t total_bytes = 0;
+        for (uint32_t i = 0; i < header->frame_count; i++) {
+            total_bytes += index->frame_sizes[i];
+        }
+        double seconds = header->frame_count / frame_rate;
+        if (stream->nb_frames == 0) {
+            stream->nb_frames = header->frame_count;
+        }
+        if (stream->duration == AV_NOPTS_VALUE && stream->time_base.num > 0) {
+            stream->duration = (int64_t)(seconds / av_q2d(stream->time_base));
+        }
+        if (stream->codecpar->bit_rate == 0) {
+            stream->codecpar->bit_rate = (int64_t)(total_bytes * 8 / seconds);
+        }
+    }
+    return true;
+}
+
+// True for "-" (stdin) and named pipes, which can only be read once from front to back
+bool is_stream_input(const char *filename) {
+    struct stat st;
+    return strcmp(filename, "-") == 0 || (stat(filename, &st) == 0 && S_ISFIFO(st.st_mode));
+}
+
+// Open a pipe for reading. Stdin keeps its data on a duplicate descriptor and is reattached to the terminal,
+// so key handling and the character set prompt still read from the keyboard.
+int stream_input_open(const char *filename, StreamInput *in) {
+    if (strcmp(filename, "-") == 0) {
+        in->fd = dup(STDIN_FILENO);
+        if (in->fd >= 0 && !freopen("/dev/tty", "r", stdin)) {
+            fprintf(stderr, "Warning: No terminal available for key input.\n");
+        }
+    } else {
+        in->fd = open(filename, O_RDONLY);
+    }
+    if (in->fd < 0) {
+        fprintf(stderr, "Error: Cannot open input stream: %s\n", filename);
+        return -1;
+    }
+    return 0;
+}
+
+// Read the probe prefix; blocks until STREAM_PROBE_SIZE bytes arrive or the writer closes the pipe
+int stream_input_read_probe(StreamInput *in) {
+    in->probe_data = malloc(STREAM_PROBE_SIZE + AVPROBE_PADDING_SIZE);
+    if (!in->probe_data) {
+        fprintf(stderr, "Error: Cannot allocate the stream probe buffer.\n");
+        return -1;
+    }
+
+    while (in->probe_size < STREAM_PROBE_SIZE) {
+        ssize_t n = read(in->fd, in->probe_data + in->probe_size, STREAM_PROBE_SIZE - in->probe_size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        in->probe_size += n;
+    }
+    memset(in->probe_data + in->probe_size, 0, AVPROBE_PADDING_SIZE);
+    return in->probe_size > 0 ? 0 : -1;
+}
+
+// AVIOContext read callback: replay the probe prefix, then read the pipe
+int stream_input_read(void *opaque, uint8_t *buf, int buf_size) {
+    StreamInput *in = (StreamInput *)opaque;
+
+    if (in->probe_offset < in->probe_size) {
+        size_t n = in->probe_size - in->probe_offset;
+        if (n > (size_t)buf_size) {
+            n = buf_size;
+        }
+        memcpy(buf, in->probe_data + in->probe_offset, n);
+        in->probe_offset += n;
+        return (int)n;
+    }
+
+    ssize_t n;
+    do {
+        n = read(in->fd, buf, buf_size);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        return AVERROR(errno);
+    }
+    return n > 0 ? (int)n : AVERROR_EOF;
+}
+
+// Read the whole stream into memory, starting with the probe prefix; used for still images
+uint8_t *stream_input_read_all(StreamInput *in, size_t *size) {
+    size_t capacity = in->probe_size + STREAM_PROBE_SIZE;
+    uint8_t *data = malloc(capacity);
+    if (!data) {
+        return NULL;
+    }
+    memcpy(data, in->probe_data, in->probe_size);
+    *size = in->probe_size;
+
+    for (;;) {
+        if (*size == capacity) {
+            uint8_t *grown = realloc(data, capacity * 2);
+            if (!grown) {
+                free(data);
+                return NULL;
+            }
+            data = grown;
+            capacity *= 2;
+        }
+
+        ssize_t n = read(in->fd, data + *size, capacity - *size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        *size += n;
+    }
+    return data;
+}
+
+// Hand the stream to a new format context through a custom AVIOContext
+int stream_input_attach(StreamInput *in, AVFormatContext **pFormatContext) {
+    uint8_t *buffer = av_malloc(STREAM_AVIO_BUFFER_SIZE);
+    if (buffer) {
+        in->avio = avio_alloc_context(buffer, STREAM_AVIO_BUFFER_SIZE, 0, in, stream_input_read, NULL, NULL);
+    }
+    if (!in->avio) {
+        av_free(buffer);
+        fprintf(stderr, "Error: Cannot allocate the stream reader.\n");
+        return -1;
+    }
+
+    *pFormatContext = avformat_alloc_context();
+    if (!*pFormatContext) {
+        fprintf(stderr, "Error: Cannot allocate the format context.\n");
+        return -1;
+    }
+    (*pFormatContext)->pb = in->avio;
+    (*pFormatContext)->flags |= AVFMT_FLAG_CUSTOM_IO;
+    return 0;
+}
+
+// Free the reader; the format context does not own a custom AVIOContext, so call this after closing it
+void stream_input_close(StreamInput *in) {
+    if (in->avio) {
+        av_freep(&in->avio->buffer);
+        avio_context_free(&in->avio);
+    }
+    free(in->probe_data);
+    in->probe_data = NULL;
+    in->probe_size = in->probe_offset = 0;
+    if (in->fd >= 0) {
+        close(in->fd);
+        in->fd = -1;
+    }
+}
+
+int init_ffmpeg(const char *filename, AVFormatContext **pFormatContext, AVCodecContext **pCodecContext, int *video_stream_index,
+                SidecarIndex *index) {
+    // Network setup is only needed for URLs, and is measurable on startup for local files
+    if (strstr(filename, "://")) {
+        avformat_network_init();
+    }
+
+    // Bound how much of the input is read and analysed before the first packet can be decoded
+    AVDictionary *options = NULL;
+    if (live_mode) {
+        // Live sources: probe the minimum and keep the demuxer from buffering packets ahead
+        av_dict_set_int(&options, "probesize", LIVE_PROBESIZE, 0);
+        av_dict_set_int(&options, "analyzeduration", 0, 0);
+        av_dict_set(&options, "fflags", "nobuffer", 0);
+    } else {
+        av_dict_set_int(&options, "probesize", FAST_START_PROBESIZE, 0);
+        av_dict_set_int(&options, "analyzeduration", FAST_START_ANALYZE_DURATION, 0);
+    }
+
+    // A sidecar index names the demuxer, which skips format probing
+    const AVInputFormat *input_format = index ? av_find_input_format(index->header.format_name) : NULL;
+
+    if (raw_video_size) {
+        // Raw frames carry no header: size, pixel format and rate come from the command line
+        input_format = av_find_input_format("rawvideo");
+        av_dict_set(&options, "video_size", raw_video_size, 0);
+        av_dict_set(&options, "pixel_format", raw_pixel_format, 0);
+        av_dict_set(&options, "framerate", raw_frame_rate, 0);
+    } else if (stream_input.probe_size > 0) {
+        // Probe the prefix already read from the pipe; if nothing matches, the demuxer probes through the reader
+        AVProbeData probe_data = {
+            .filename = strcmp(filename, "-") == 0 ? "" : filename,
+            .buf = stream_input.probe_data,
+            .buf_size = (int)stream_input.probe_size
+        };
+        input_format = av_probe_input_format(&probe_data, 1);
+    }
+
+    if (stream_input.fd >= 0 && stream_input_attach(&stream_input, pFormatContext) != 0) {
+        av_dict_free(&options);
+        return -1;
+    }
+
+    if (avformat_open_input(pFormatContext, filename, input_format, &options) != 0) {
+        fprintf(stderr, "Could not open video file: %s\n", filename);
+        av_dict_free(&options);
         return -1;
     }
+    av_dict_free(&options);
+
+    if (index && apply_sidecar_index(*pFormatContext, index)) {
+        *video_stream_index = index->header.stream_index;
+    } else {
+        // An index for a different codec or stream layout is dropped, so it is rebuilt and never used for seeks
+        if (index && index->is_loaded) {
+            fprintf(stderr, "Ignoring mismatched index for: %s\n", filename);
+            sidecar_index_free(index);
+        }
+        if (avformat_find_stream_info(*pFormatContext, NULL) < 0) {
+            fprintf(stderr, "Could not find stream information.\n");
+            avformat_close_input(pFormatContext);
+            return -1;
+        }
+    }
 
     // Find the video stream
-    for (int i = 0; i < (*pFormatContext)->nb_streams; i++) {
+    for (int i = 0; *video_stream_index == -1 && i < (*pFormatContext)->nb_streams; i++) {
         if ((*pFormatContext)->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
             *video_stream_index = i;
             break;
@@ -203,6 +993,12 @@ int init_ffmpeg(const char *filename, AVFormatContext **pFormatContext, AVCodecC
         avformat_close_input(pFormatContext);
         return -1;
     }
+    if (live_mode) {
+        (*pCodecContext)->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    }
+    if (image_decode_lowres > 0 && codec->max_lowres > 0) {
+        (*pCodecContext)->lowres = image_decode_lowres < codec->max_lowres ? image_decode_lowres : codec->max_lowres;
+    }
 
     if (avcodec_open2(*pCodecContext, codec, NULL) < 0) {
         fprintf(stderr, "Failed to open codec.\n");
@@ -231,11 +1027,6 @@ void get_terminal_size(int *rows, int *cols) {
     *cols = w.ws_col;
 }
 
-// Function to print colored ASCII characters with a black background
-static inline void print_colored_char(char ascii_char, int r, int g, int b) {
-    printf("\033[48;2;0;0;0m\033[38;2;%d;%d;%dm%c", r, g, b, ascii_char);
-}
-
 // Function to clear the terminal
 void clear_terminal() {
     printf("\033[2J\033[H");  // Clear the terminal and move the cursor to the top
@@ -272,6 +1063,9 @@ void print_profiling_results() {
         printf(" - Average Receive Frame Time per Frame: %.6f seconds\n", producer_receive_frame_total_time / producer_frame_count);
         printf(" - Average Convert Frame Time per Frame: %.6f seconds\n", producer_convert_frame_total_time / producer_frame_count);
         printf(" - Average Cache Time per Frame: %.6f seconds\n", producer_cache_total_time / producer_frame_count);
+        if (producer_skipped_frame_count > 0) {
+            printf(" - Frames Skipped Before Conversion: %d\n", producer_skipped_frame_count);
+        }
     } else {
         printf("No frames produced.\n");
     }
@@ -282,737 +1076,4057 @@ void print_profiling_results() {
         printf(" - Average Lock & Wait Time per Frame: %.6f seconds\n", consumer_lock_wait_total / consumer_frame_count);
         printf(" - Average Render Time per Frame: %.6f seconds\n", consumer_render_total / consumer_frame_count);
         printf(" - Average Buffer Update Time per Frame: %.6f seconds\n", consumer_buffer_update_total / consumer_frame_count);
+        if (consumer_dropped_frame_count > 0) {
+            printf(" - Late Frames Dropped: %d\n", consumer_dropped_frame_count);
+        }
+        if (live_mode) {
+            printf(" - Average Input-to-Display Latency: %.2f ms (max %.2f ms)\n",
+                   live_latency_total / consumer_frame_count * 1000.0, live_latency_max * 1000.0);
+            printf(" - Frames Replaced Before Display: %d of %d\n", live_overwritten_count, live_published_count);
+        }
     } else {
         printf("No frames consumed.\n");
     }
 
+    if (loop_replayed_frame_count > 0) {
+        printf("Loop Cache: %d frames, %.1f KB, %d frames replayed without decoding\n",
+               loop_cache_count, loop_cache_bytes / 1024.0, loop_replayed_frame_count);
+    }
+
+    print_time_to_first_frame();
+
     printf("\033[?25h");
 }
 
-// Function to initialize the cached pixel array
-void cache_grayscale_values(const unsigned char *img, int img_width, int img_height, CachedPixel *cached_img) {
-    #pragma omp parallel for
-    for (int y = 0; y < img_height; y++) {
-        for (int x = 0; x < img_width; x++) {
-            int index = (y * img_width + x) * 3;
-            int r = img[index];
-            int g = img[index + 1];
-            int b = img[index + 2];
-
-            cached_img[y * img_width + x].r = r;
-            cached_img[y * img_width + x].g = g;
-            cached_img[y * img_width + x].b = b;
-            cached_img[y * img_width + x].gray_value = 0.299 * r + 0.587 * g + 0.114 * b;
-        }
+// Convert a run of packed RGB pixels, one at a time
+static void cache_pixel_span_scalar(const unsigned char *img, CachedPixel *cached_img, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int r = img[i * 3];
+        int g = img[i * 3 + 1];
+        int b = img[i * 3 + 2];
+
+        CachedPixel *pixel = &cached_img[i];
+        pixel->r = r;
+        pixel->g = g;
+        pixel->b = b;
+        pixel->gray_value = luma_from_rgb(r, g, b);
     }
 }
 
+// The SIMD variants hold four pixels per 32-bit lane as r | g << 8 | b << 16. Masking out bytes 0 and 2 leaves
+// 16-bit lanes {r, b}, shifting first leaves {g, 0}, and two pmaddwd against the weights give the luma sums.
+#ifdef __SSE2__
+// Four pixels per step, each loaded as a 32-bit word; the word reads one byte past the pixel, so the last pixel
+// is left to the scalar loop
+static void cache_pixel_span_sse2(const unsigned char *img, CachedPixel *cached_img, size_t count) {
+    const __m128i rgb_mask = _mm_set1_epi32(0x00ffffff);
+    const __m128i byte_mask = _mm_set1_epi32(0x00ff00ff);
+    const __m128i weights_rb = _mm_set1_epi32(LUMA_WEIGHT_B << 16 | LUMA_WEIGHT_R);
+    const __m128i weights_g = _mm_set1_epi32(LUMA_WEIGHT_G);
+
+    size_t i = 0;
+    for (; i + 5 <= count; i += 4) {
+        uint32_t p[4];
+        memcpy(p, img + i * 3, 4);
+        memcpy(p + 1, img + i * 3 + 3, 4);
+        memcpy(p + 2, img + i * 3 + 6, 4);
+        memcpy(p + 3, img + i * 3 + 9, 4);
+        __m128i v = _mm_and_si128(_mm_setr_epi32(p[0], p[1], p[2], p[3]), rgb_mask);
+
+        __m128i sum = _mm_add_epi32(_mm_madd_epi16(_mm_and_si128(v, byte_mask), weights_rb),
+                                    _mm_madd_epi16(_mm_and_si128(_mm_srli_epi32(v, 8), byte_mask), weights_g));
+        v = _mm_or_si128(v, _mm_slli_epi32(_mm_srli_epi32(sum, LUMA_SHIFT), 24));
+        _mm_storeu_si128((__m128i *)(cached_img + i), v);
+    }
+    cache_pixel_span_scalar(img + i * 3, cached_img + i, count - i);
+}
+#endif
+
+#ifdef PIXEL_SPAN_X86_DISPATCH
+// Eight pixels per step: two 16-byte loads of four pixels each, spread to 32-bit lanes by pshufb. The second load
+// reads four bytes past its pixels, so the last pixels are left to the scalar loop.
+__attribute__((target("avx2")))
+static void cache_pixel_span_avx2(const unsigned char *img, CachedPixel *cached_img, size_t count) {
+    const __m256i spread = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                            0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m256i byte_mask = _mm256_set1_epi32(0x00ff00ff);
+    const __m256i weights_rb = _mm256_set1_epi32(LUMA_WEIGHT_B << 16 | LUMA_WEIGHT_R);
+    const __m256i weights_g = _mm256_set1_epi32(LUMA_WEIGHT_G);
+
+    size_t i = 0;
+    for (; i + 10 <= count; i += 8) {
+        __m128i low = _mm_loadu_si128((const __m128i *)(img + i * 3));
+        __m128i high = _mm_loadu_si128((const __m128i *)(img + i * 3 + 12));
+        __m256i v = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1), spread);
+
+        __m256i sum = _mm256_add_epi32(_mm256_madd_epi16(_mm256_and_si256(v, byte_mask), weights_rb),
+                                       _mm256_madd_epi16(_mm256_and_si256(_mm256_srli_epi32(v, 8), byte_mask), weights_g));
+        v = _mm256_or_si256(v, _mm256_slli_epi32(_mm256_srli_epi32(sum, LUMA_SHIFT), 24));
+        _mm256_storeu_si256((__m256i *)(cached_img + i), v);
+    }
+    cache_pixel_span_scalar(img + i * 3, cached_img + i, count - i);
+}
 
-// Modify print function to move cursor back to the beginning instead of clearing
-void render_ascii_art_terminal(CachedPixel *cached_img, int img_width, int img_height, int term_rows, int term_cols, const char *char_set, int char_set_size, DebugInfo *debug_info) {
-    static double total_render_time = 0.0;
-    static int frame_count = 0;
+// Sixteen pixels per step from one 48-byte masked load, so the tail needs no scalar loop: vpermd moves each
+// 12-byte group of four pixels into its own 128-bit lane, then pshufb spreads them as in the AVX2 variant
+__attribute__((target("avx512f,avx512bw")))
+static void cache_pixel_span_avx512(const unsigned char *img, CachedPixel *cached_img, size_t count) {
+    const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 0, 3, 4, 5, 0, 6, 7, 8, 0, 9, 10, 11, 0);
+    const __m512i spread = _mm512_broadcast_i32x4(_mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1));
+    const __m512i byte_mask = _mm512_set1_epi32(0x00ff00ff);
+    const __m512i weights_rb = _mm512_set1_epi32(LUMA_WEIGHT_B << 16 | LUMA_WEIGHT_R);
+    const __m512i weights_g = _mm512_set1_epi32(LUMA_WEIGHT_G);
+
+    for (size_t i = 0; i < count; i += 16) {
+        size_t n = count - i < 16 ? count - i : 16;
+        __mmask64 load_mask = ((__mmask64)1 << (n * 3)) - 1;
+        __m512i v = _mm512_maskz_loadu_epi8(load_mask, img + i * 3);
+        v = _mm512_shuffle_epi8(_mm512_permutexvar_epi32(lanes, v), spread);
+
+        __m512i sum = _mm512_add_epi32(_mm512_madd_epi16(_mm512_and_si512(v, byte_mask), weights_rb),
+                                       _mm512_madd_epi16(_mm512_and_si512(_mm512_srli_epi32(v, 8), byte_mask), weights_g));
+        v = _mm512_or_si512(v, _mm512_slli_epi32(_mm512_srli_epi32(sum, LUMA_SHIFT), 24));
+        _mm512_mask_storeu_epi32(cached_img + i, (__mmask16)((1u << n) - 1), v);
+    }
+}
 
-    float char_aspect_ratio = 2.0;
+static bool cpu_has_avx2(void) {
+    return __builtin_cpu_supports("avx2");
+}
 
-    // Precompute scaled dimensions once and reuse in loops
-    term_rows -= debug_lines;
-    float img_aspect_ratio = (float)img_width / img_height;
+static bool cpu_has_avx512(void) {
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+}
+#endif
+
+typedef void (*PixelSpanFunction)(const unsigned char *img, CachedPixel *cached_img, size_t count);
+
+// Conversion variants, slowest first; all produce identical output
+static const struct {
+    const char *name;
+    PixelSpanFunction convert;
+    bool (*supported)(void);  // NULL if the build target already guarantees the instructions
+} pixel_span_variants[] = {
+    {"scalar", cache_pixel_span_scalar, NULL},
+#ifdef __SSE2__
+    {"sse2", cache_pixel_span_sse2, NULL},
+#endif
+#ifdef PIXEL_SPAN_X86_DISPATCH
+    {"avx2", cache_pixel_span_avx2, cpu_has_avx2},
+    {"avx512", cache_pixel_span_avx512, cpu_has_avx512},
+#endif
+};
+#define PIXEL_SPAN_VARIANT_COUNT ((int)(sizeof(pixel_span_variants) / sizeof(pixel_span_variants[0])))
+
+static int pixel_span_variant = 0;
+static pthread_once_t pixel_span_once = PTHREAD_ONCE_INIT;
+
+static bool pixel_span_variant_supported(int variant) {
+    return !pixel_span_variants[variant].supported || pixel_span_variants[variant].supported();
+}
 
-    int target_width = term_cols;
-    int target_height = target_width / img_aspect_ratio / char_aspect_ratio;
-    if (target_height > term_rows) {
-        target_height = term_rows;
-        target_width = target_height * img_aspect_ratio * char_aspect_ratio;
+// Pick the fastest variant this CPU runs, from CPUID
+static void select_pixel_span_variant(void) {
+#ifdef PIXEL_SPAN_X86_DISPATCH
+    __builtin_cpu_init();
+#endif
+    for (int variant = 0; variant < PIXEL_SPAN_VARIANT_COUNT; variant++) {
+        if (pixel_span_variant_supported(variant)) {
+            pixel_span_variant = variant;
+        }
     }
+}
 
-    // Hide the cursor before rendering
-    printf("\033[?25l");  // Hide cursor
-
-    // Clear terminal and move the cursor to the top before every render
-    printf("\033[H");
-    printf("\0337");  // Save cursor position
-//    printf("\033[2J\033[H");  // Clear terminal and move the cursor to the top
+static void cache_pixel_span(const unsigned char *img, CachedPixel *cached_img, size_t count) {
+    pthread_once(&pixel_span_once, select_pixel_span_variant);
+    pixel_span_variants[pixel_span_variant].convert(img, cached_img, count);
+}
 
-    // Use the precomputed grayscale value from CachedPixel
-    for (int y = 0; y < target_height; y++) {
-        for (int x = 0; x < target_width; x++) {
-            int img_x = x * img_width / target_width;
-            int img_y = y * img_height / target_height;
+// First pixel at or after index whose cached copy starts a cache line, so two bands never write the same line
+static size_t cache_line_boundary(const CachedPixel *cached_img, size_t index, size_t count) {
+    uintptr_t address = (uintptr_t)(cached_img + index);
+    uintptr_t aligned = (address + CACHE_LINE_SIZE - 1) & ~(uintptr_t)(CACHE_LINE_SIZE - 1);
+    index += (aligned - address) / sizeof(CachedPixel);
+    return index < count ? index : count;
+}
 
-            CachedPixel pixel = cached_img[img_y * img_width + img_x];
+// Threads for the OpenMP loops: --threads, else the OpenMP default (OMP_NUM_THREADS or one per CPU)
+int parallel_thread_count(void) {
+#ifdef _OPENMP
+    return cache_thread_count > 0 ? cache_thread_count : omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
 
-            // Use precomputed grayscale value instead of calling get_ascii_char
-            int gray = pixel.gray_value;
-            char ascii_char = char_set[(gray * (char_set_size - 1)) / 255];
-            print_colored_char(ascii_char, pixel.r, pixel.g, pixel.b);
+// Function to initialize the cached pixel array.
+// Images large enough are split into one band of rows per thread, with the band edges moved onto cache lines.
+// Small images stay on the calling thread.
+void cache_grayscale_values(const unsigned char *img, int img_width, int img_height, CachedPixel *cached_img) {
+    size_t count = (size_t)img_width * img_height;
+    int band_count = 1;
+#ifdef _OPENMP
+    if (count >= CACHE_PARALLEL_MIN_PIXELS) {
+        band_count = parallel_thread_count();
+        if (band_count > img_height) {
+            band_count = img_height;
         }
-        printf("\033[0m\n");  // Reset color after each line
     }
-
-    // Print debug info
-    if (debug_info && debug_info->has_fps_info) {
-        printf("Original: %dx%d (AR: %.2f) | New: %dx%d (AR: %.2f) | Term: %dx%d | FPS: %.2f | Frame delay: %.2f ms\n",
-               img_width, img_height, img_aspect_ratio, target_width, target_height, (float)target_width / target_height,
-               term_cols, term_rows + debug_lines, debug_info->avg_fps, debug_info->avg_frame_delay);
-    } else {
-        printf("Original: %dx%d (AR: %.2f) | New: %dx%d (AR: %.2f) | Term: %dx%d\n",
-               img_width, img_height, img_aspect_ratio, target_width, target_height, (float)target_width / target_height,
-               term_cols, term_rows + debug_lines);
+#endif
+    if (band_count <= 1) {
+        cache_pixel_span(img, cached_img, count);
+        return;
     }
 
-    printf("\0338");  // Restore cursor position
-    fflush(stdout);   // might have to put this back and pass in the fps stuff in params for image
-}
-
-// Helper function to render ASCII characters using stb_truetype
-void render_ascii_to_image(unsigned char *output_img, int x, int y, char ascii_char, int img_width, int img_height, int r, int g, int b) {
-    int width, height, x_offset, y_offset;
-    float scale_factor = stbtt_ScaleForPixelHeight(&font, FONT_SIZE);
-    unsigned char *bitmap = stbtt_GetCodepointBitmap(&font, 0, scale_factor, ascii_char, &width, &height, &x_offset, &y_offset);
-
-    // Render the ASCII character with the foreground color (r, g, b) on a black background
-    for (int i = 0; i < height; ++i) {
-        for (int j = 0; j < width; ++j) {
-            int output_x = x + j;
-            int output_y = y + i;
-            int output_index = (output_y * img_width + output_x) * 4;
-
-            // Check for out-of-bounds writes (improved for both width and height)
-            if (output_x >= 0 && output_x < img_width && output_y >= 0 && output_y < img_height) {
-                if (bitmap[i * width + j]) {
-                    output_img[output_index] = r;       // Red channel
-                    output_img[output_index + 1] = g;   // Green channel
-                    output_img[output_index + 2] = b;   // Blue channel
-                    output_img[output_index + 3] = 255; // Alpha (fully opaque)
-                }
-            }
+    int rows_per_band = (img_height + band_count - 1) / band_count;
+    #pragma omp parallel for num_threads(band_count) schedule(static, 1)
+    for (int band = 0; band < band_count; band++) {
+        size_t start = band == 0 ? 0 : cache_line_boundary(cached_img, (size_t)band * rows_per_band * img_width, count);
+        size_t end = band == band_count - 1 ? count
+                                            : cache_line_boundary(cached_img, (size_t)(band + 1) * rows_per_band * img_width, count);
+        if (start < end) {
+            cache_pixel_span(img + start * 3, cached_img + start, end - start);
         }
     }
-    stbtt_FreeBitmap(bitmap, NULL);
 }
 
-// Function to render ASCII art to a PNG file with scaling, black background, and colored ASCII characters
-void render_ascii_art_file_scaled(CachedPixel *cached_img, int img_width, int img_height, const char *char_set, int char_set_size, const char *output_file, float scale_factor, int font_scale) {
-    // Ensure cached_img is not NULL
-    if (!cached_img) {
-        printf("Error: Cached image is NULL.\n");
-        return;
+// Double-precision conversion the fixed-point variants replaced, kept as the --benchmark baseline
+static void cache_pixel_span_double(const unsigned char *img, CachedPixel *cached_img, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int r = img[i * 3], g = img[i * 3 + 1], b = img[i * 3 + 2];
+        cached_img[i] = (CachedPixel){r, g, b, (uint8_t)(0.299 * r + 0.587 * g + 0.114 * b)};
     }
+}
 
-    // Precompute scaled dimensions once and reuse in loops
-    int scaled_width = (int)(img_width * scale_factor);
-    int scaled_height = (int)(img_height * scale_factor);
-
-    // Allocate memory for the output image (RGBA)
-    size_t output_size = scaled_width * scaled_height * 4;
-    unsigned char *output_img = (unsigned char *)malloc(output_size);
-    if (!output_img) {
-        printf("Failed to allocate memory for output image.\n");
-        return;
+#define BENCHMARK_SIDE 4096  // 4096 x 4096 holds every 24-bit colour once
+#define BENCHMARK_RUNS 5
+
+// Best time in milliseconds over BENCHMARK_RUNS conversions
+static double time_pixel_span(PixelSpanFunction convert, const uint8_t *rgb, CachedPixel *output, size_t count) {
+    double best = 0.0;
+    for (int run = 0; run < BENCHMARK_RUNS; run++) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        convert(rgb, output, count);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+        if (run == 0 || ms < best) {
+            best = ms;
+        }
     }
+    return best;
+}
 
-    // Fill the entire output image with black (for background)
-    for (size_t i = 0; i < output_size; i += 4) {
-        output_img[i] = 0;     // Red
-        output_img[i + 1] = 0; // Green
-        output_img[i + 2] = 0; // Blue
-        output_img[i + 3] = 255; // Alpha (fully opaque)
+// Time each pixel conversion variant on one thread against the double-precision baseline, and check that every
+// variant matches the scalar one on all 24-bit colours
+int run_pixel_benchmark(void) {
+    size_t count = (size_t)BENCHMARK_SIDE * BENCHMARK_SIDE;
+    uint8_t *rgb = malloc(count * 3);
+    CachedPixel *expected = malloc(count * sizeof(CachedPixel));
+    CachedPixel *output = malloc(count * sizeof(CachedPixel));
+    if (!rgb || !expected || !output) {
+        fprintf(stderr, "Error: Failed to allocate benchmark buffers.\n");
+        free(rgb);
+        free(expected);
+        free(output);
+        return 1;
     }
 
-    // Iterate through each pixel and render ASCII characters
-    for (int y = 0; y < scaled_height; y += font_scale) {
-        for (int x = 0; x < scaled_width; x += font_scale) {
-            int img_x = (int)(x / scale_factor);
-            int img_y = (int)(y / scale_factor);
-
-            // Ensure that we're still within bounds of the input image
-            if (img_x < img_width && img_y < img_height) {
-                CachedPixel pixel = cached_img[img_y * img_width + img_x];
-                int r = pixel.r;
-                int g = pixel.g;
-                int b = pixel.b;
-
-                // Use precomputed grayscale value from CachedPixel
-                int gray = pixel.gray_value;
-
-                // Render the ASCII character at the correct position
-                char ascii_char = char_set[(gray * (char_set_size - 1)) / 255];
-                if (ascii_char != ' ') {
-                    render_ascii_to_image(output_img, x, y, ascii_char, scaled_width, scaled_height, r, g, b);
-                }
-            }
+    for (size_t i = 0; i < count; i++) {
+        rgb[i * 3] = (uint8_t)(i >> 16);
+        rgb[i * 3 + 1] = (uint8_t)(i >> 8);
+        rgb[i * 3 + 2] = (uint8_t)i;
+    }
+    cache_pixel_span_scalar(rgb, expected, count);
+    pthread_once(&pixel_span_once, select_pixel_span_variant);
+
+    printf("RGB to CachedPixel, %zu pixels, best of %d runs:\n", count, BENCHMARK_RUNS);
+    double baseline = time_pixel_span(cache_pixel_span_double, rgb, output, count);
+    printf("  %-8s %8.2f ms  %7.1f Mpixel/s\n", "double", baseline, count / baseline / 1e3);
+
+    bool all_exact = true;
+    for (int variant = 0; variant < PIXEL_SPAN_VARIANT_COUNT; variant++) {
+        if (!pixel_span_variant_supported(variant)) {
+            printf("  %-8s not supported by this CPU\n", pixel_span_variants[variant].name);
+            continue;
         }
+        memset(output, 0, count * sizeof(CachedPixel));
+        double ms = time_pixel_span(pixel_span_variants[variant].convert, rgb, output, count);
+        bool exact = memcmp(output, expected, count * sizeof(CachedPixel)) == 0;
+        all_exact = all_exact && exact;
+        printf("  %-8s %8.2f ms  %7.1f Mpixel/s  %5.2fx  %s%s\n", pixel_span_variants[variant].name, ms,
+               count / ms / 1e3, baseline / ms, exact ? "bit-exact" : "MISMATCH",
+               variant == pixel_span_variant ? "  (selected)" : "");
     }
 
-    // Save the output image as PNG
-    stbi_write_png(output_file, scaled_width, scaled_height, 4, output_img, scaled_width * 4);
-
-    free(output_img);
+    free(rgb);
+    free(expected);
+    free(output);
+    return all_exact ? 0 : 1;
 }
 
-void render_ascii_art_file_txt(CachedPixel *cached_img, int img_width, int img_height, const char *char_set, int char_set_size, const char *output_file, int term_rows, int term_cols) {
-    // Ensure cached_img is not NULL
-    if (!cached_img) {
-        printf("Error: Cached image is NULL.\n");
-        return;
-    }
 
+// Compute the character grid for an image in a terminal, keeping the image aspect ratio with 2:1 character cells
+void compute_render_grid_size(int img_width, int img_height, int term_rows, int term_cols, int *target_width, int *target_height) {
     float char_aspect_ratio = 2.0;
 
-    // Adjust terminal height to account for debug information
+    // Leave room for the debug lines under the image
     term_rows -= debug_lines;
     float img_aspect_ratio = (float)img_width / img_height;
 
-    int target_width = term_cols;
-    int target_height = target_width / img_aspect_ratio / char_aspect_ratio;
-    if (target_height > term_rows) {
-        target_height = term_rows;
-        target_width = target_height * img_aspect_ratio * char_aspect_ratio;
-    }
-
-    // Open the output file for writing
-    FILE *file = fopen(output_file, "w");
-    if (!file) {
-        printf("Failed to create output file: %s\n", output_file);
-        return;
+    *target_width = term_cols;
+    *target_height = *target_width / img_aspect_ratio / char_aspect_ratio;
+    if (*target_height > term_rows) {
+        *target_height = term_rows;
+        *target_width = *target_height * img_aspect_ratio * char_aspect_ratio;
     }
+}
 
-    // Write the ASCII art to the text file using the same logic as terminal rendering
+// Downsample an image to one pixel per character cell, sampling the top-left source pixel of each cell.
+// img_stride is the row length in pixels, so a sub-rectangle of a larger image can be sampled in place.
+void sample_render_grid(const CachedPixel *cached_img, int img_stride, int img_width, int img_height, CachedPixel *grid, int target_width, int target_height) {
     for (int y = 0; y < target_height; y++) {
+        int img_y = (int)((int64_t)y * img_height / target_height);
         for (int x = 0; x < target_width; x++) {
-            int img_x = x * img_width / target_width;
-            int img_y = y * img_height / target_height;
+            int img_x = (int)((int64_t)x * img_width / target_width);
+            grid[(size_t)y * target_width + x] = cached_img[(size_t)img_y * img_stride + img_x];
+        }
+    }
+}
 
-            CachedPixel pixel = cached_img[img_y * img_width + img_x];
+// Status line printed below every terminal render
+void print_render_debug_line(int target_width, int target_height, int img_width, int img_height, int term_rows, int term_cols, const DebugInfo *debug_info) {
+    float img_aspect_ratio = (float)img_width / img_height;
 
-            // Use precomputed grayscale value from CachedPixel
-            int gray = pixel.gray_value;
-            char ascii_char = char_set[(gray * (char_set_size - 1)) / 255];
+    printf("Original: %dx%d (AR: %.2f) | New: %dx%d (AR: %.2f) | Term: %dx%d",
+           img_width, img_height, img_aspect_ratio, target_width, target_height, (float)target_width / target_height,
+           term_cols, term_rows);
+    if (debug_info && debug_info->has_fps_info) {
+        printf(" | FPS: %.2f | Frame delay: %.2f ms", debug_info->avg_fps, debug_info->avg_frame_delay);
+    }
+    if (debug_info && debug_info->has_latency) {
+        printf(" | Latency: %.1f ms", debug_info->latency_ms);
+    }
+}
 
-            // Write the ASCII character to the file
-            fputc(ascii_char, file);
+// Size a grid for width x height cells of char_set, growing its storage if needed. Drops any background colours.
+int cell_grid_resize(CellGrid *grid, int width, int height, const char *char_set, int char_set_size) {
+    size_t cell_count = (size_t)width * height;
+    if (cell_count > grid->capacity) {
+        Cell *cells = realloc(grid->cells, cell_count * sizeof(Cell));
+        if (!cells) {
+            return -1;
         }
-        fputc('\n', file);  // Newline after each row
+        grid->cells = cells;
+        grid->capacity = cell_count;
     }
-
-    fclose(file);
-    printf("ASCII art saved to text file: %s\n", output_file);
+    free(grid->bg);
+    grid->bg = NULL;
+    grid->width = width;
+    grid->height = height;
+    grid->char_set = char_set;
+    grid->char_set_size = char_set_size;
+    return 0;
 }
 
-void *frame_producer(void *args) {
-    ProducerArgs *prod_args = (ProducerArgs *)args;
-
-    AVFormatContext *pFormatContext = prod_args->pFormatContext;
-    AVCodecContext *pCodecContext = prod_args->pCodecContext;
-    int video_stream_index = prod_args->video_stream_index;
-
-    struct SwsContext *sws_ctx = sws_getContext(
-        pCodecContext->width, pCodecContext->height, pCodecContext->pix_fmt,
-        pCodecContext->width, pCodecContext->height, AV_PIX_FMT_RGB24,
-        SWS_FAST_BILINEAR, NULL, NULL, NULL
-    );
+void cell_grid_free(CellGrid *grid) {
+    free(grid->cells);
+    free(grid->bg);
+    memset(grid, 0, sizeof(*grid));
+}
 
-    if (!sws_ctx) {
-        print_timestamp("Failed to initialize the SWS context");
-        pthread_exit(NULL);
+// Map one averaged pixel per cell to glyphs: the luma picks the glyph, the colour becomes the foreground
+void cell_grid_fill(CellGrid *grid, const CachedPixel *pixels) {
+    size_t cell_count = (size_t)grid->width * grid->height;
+    for (size_t i = 0; i < cell_count; i++) {
+        grid->cells[i] = (Cell){(uint8_t)((pixels[i].gray_value * (grid->char_set_size - 1)) / 255),
+                                {pixels[i].r, pixels[i].g, pixels[i].b}};
     }
+}
 
-    AVPacket *packet = av_packet_alloc();
-    if (!packet) {
-        print_timestamp("Failed to allocate packet");
-        sws_freeContext(sws_ctx);
-        pthread_exit(NULL);
+// Size and fill a grid in one go
+int cell_grid_from_pixels(CellGrid *grid, const CachedPixel *pixels, int width, int height, const char *char_set, int char_set_size) {
+    if (cell_grid_resize(grid, width, height, char_set, char_set_size) != 0) {
+        return -1;
     }
+    cell_grid_fill(grid, pixels);
+    return 0;
+}
 
-    AVFrame *frame = av_frame_alloc();
-    if (!frame) {
-        print_timestamp("Failed to allocate frame");
-        av_packet_free(&packet);
-        sws_freeContext(sws_ctx);
-        pthread_exit(NULL);
-    }
+static inline char cell_char(const CellGrid *grid, size_t i) {
+    return grid->char_set[grid->cells[i].glyph];
+}
 
-    int pool_index = 0; // Index for using frames and buffers from the pool
-    int current_buffer = 0; // 0 for Buffer A, 1 for Buffer B
+static inline CellColor cell_background(const CellGrid *grid, size_t i) {
+    return grid->bg ? grid->bg[i] : (CellColor){0, 0, 0};
+}
 
-    int producer_id = prod_args->producer_id;
+static inline bool cells_equal(const CellGrid *a, size_t i, const CellGrid *b, size_t j) {
+    Cell x = a->cells[i], y = b->cells[j];
+    CellColor x_bg = cell_background(a, i), y_bg = cell_background(b, j);
+    return cell_char(a, i) == cell_char(b, j) && x.fg.r == y.fg.r && x.fg.g == y.fg.g && x.fg.b == y.fg.b &&
+           x_bg.r == y_bg.r && x_bg.g == y_bg.g && x_bg.b == y_bg.b;
+}
 
-    // Granular profiling
-    struct timespec read_frame_start, read_frame_end;
-    struct timespec send_packet_start, send_packet_end;
-    struct timespec receive_frame_start, receive_frame_end;
-    struct timespec convert_frame_start, convert_frame_end;
-    struct timespec cache_start, cache_end;
+// Function to print a colored character cell on its background
+static inline void print_cell(const CellGrid *grid, size_t i) {
+    CellColor fg = grid->cells[i].fg, bg = cell_background(grid, i);
+    printf("\033[48;2;%d;%d;%dm\033[38;2;%d;%d;%dm%c", bg.r, bg.g, bg.b, fg.r, fg.g, fg.b, cell_char(grid, i));
+}
 
-    double read_frame_total_time = 0.0;
-    double send_packet_total_time = 0.0;
-    double receive_frame_total_time = 0.0;
-    double convert_frame_total_time = 0.0;
-    double cache_total_time = 0.0;
+// Terminal serializer; img_width/img_height are only used for the debug line
+void render_cell_grid_terminal(const CellGrid *grid, int img_width, int img_height, int term_rows, int term_cols, DebugInfo *debug_info) {
+    mark_first_output();
 
+    // Hide the cursor before rendering
+    printf("\033[?25l");  // Hide cursor
 
-    while (is_running && !terminated) {
-        clock_gettime(CLOCK_MONOTONIC, &producer_start_time);  // Start profiling
+    // Clear terminal and move the cursor to the top before every render
+    printf("\033[H");
+    printf("\0337");  // Save cursor position
+//    printf("\033[2J\033[H");  // Clear terminal and move the cursor to the top
 
-        clock_gettime(CLOCK_MONOTONIC, &read_frame_start);
+    for (int y = 0; y < grid->height; y++) {
+        for (int x = 0; x < grid->width; x++) {
+            print_cell(grid, (size_t)y * grid->width + x);
+        }
+        printf("\033[0m\n");  // Reset color after each line
+    }
 
-        int ret = av_read_frame(pFormatContext, packet);
+    // Print debug info
+    print_render_debug_line(grid->width, grid->height, img_width, img_height, term_rows, term_cols, debug_info);
+    printf("\n");
 
-        clock_gettime(CLOCK_MONOTONIC, &read_frame_end);
-        read_frame_total_time += (read_frame_end.tv_sec - read_frame_start.tv_sec) + (read_frame_end.tv_nsec - read_frame_start.tv_nsec) / 1e9;
+    printf("\0338");  // Restore cursor position
+    fflush(stdout);   // might have to put this back and pass in the fps stuff in params for image
+}
 
-        if (ret < 0) {
-            if (ret == AVERROR_EOF) {
-                // End of file reached, no more packets to read
-                break;
-            } else {
-                fprintf(stderr, "Error reading frame: %s\n", av_err2str(ret));
-            }
-            break; // Exit the loop if there's an error or EOF
-        }
+// Cells on screen from the last still render, so a refinement only has to repaint what changed
+CellGrid painted_grid;
 
-        if (packet->stream_index == video_stream_index) {
-            clock_gettime(CLOCK_MONOTONIC, &send_packet_start);
+void remember_painted_grid(const CellGrid *grid) {
+    size_t cell_count = (size_t)grid->width * grid->height;
+    if (cell_grid_resize(&painted_grid, grid->width, grid->height, grid->char_set, grid->char_set_size) != 0 ||
+        (grid->bg && !(painted_grid.bg = malloc(cell_count * sizeof(CellColor))))) {
+        cell_grid_free(&painted_grid);
+        return;
+    }
+    memcpy(painted_grid.cells, grid->cells, cell_count * sizeof(Cell));
+    if (grid->bg) {
+        memcpy(painted_grid.bg, grid->bg, cell_count * sizeof(CellColor));
+    }
+}
 
-            // Lock decoder access
-            pthread_mutex_lock(&decoder_mutex);
-            ret = avcodec_send_packet(pCodecContext, packet);
+// Repaint only the cells whose glyph or colours differ from what is on screen, jumping the cursor over unchanged
+// runs. A grid of a different shape than the last one clears the terminal and paints everything.
+void render_cell_grid_terminal_diff(const CellGrid *grid, int img_width, int img_height, int term_rows, int term_cols, DebugInfo *debug_info) {
+    if (!painted_grid.cells || grid->width != painted_grid.width || grid->height != painted_grid.height) {
+        clear_terminal();
+        render_cell_grid_terminal(grid, img_width, img_height, term_rows, term_cols, debug_info);
+        remember_painted_grid(grid);
+        return;
+    }
 
-            pthread_mutex_unlock(&decoder_mutex);
+    mark_first_output();
+    printf("\033[?25l");  // Hide cursor
 
-            if (ret == AVERROR(EAGAIN)) {
-                usleep(10000); // Small sleep to allow buffer processing
+    for (int y = 0; y < grid->height; y++) {
+        bool in_run = false;  // The cursor already sits on this cell
+        for (int x = 0; x < grid->width; x++) {
+            size_t i = (size_t)y * grid->width + x;
+            if (cells_equal(grid, i, &painted_grid, i)) {
+                in_run = false;
                 continue;
             }
+            if (!in_run) {
+                printf("\033[%d;%dH", y + 1, x + 1);
+                in_run = true;
+            }
+            print_cell(grid, i);
+        }
+    }
+    remember_painted_grid(grid);
 
-            clock_gettime(CLOCK_MONOTONIC, &send_packet_end);
-            send_packet_total_time += (send_packet_end.tv_sec - send_packet_start.tv_sec) +
-                                      (send_packet_end.tv_nsec - send_packet_start.tv_nsec) / 1e9;
+    // The debug line sits right below the grid; clear its tail in case the new one is shorter
+    printf("\033[0m\033[%d;1H", grid->height + 1);
+    print_render_debug_line(grid->width, grid->height, img_width, img_height, term_rows, term_cols, debug_info);
+    printf("\033[K\033[H");
+    fflush(stdout);
+}
 
-            if (ret < 0) {
-                fprintf(stderr, "Error sending packet to decoder: %s\n", av_err2str(ret));
-                av_packet_unref(packet);
-                continue;
-            }
+// Text serializer: one line of glyphs per row of cells
+void write_cell_grid_txt(const CellGrid *grid, FILE *file) {
+    for (int y = 0; y < grid->height; y++) {
+        for (int x = 0; x < grid->width; x++) {
+            fputc(cell_char(grid, (size_t)y * grid->width + x), file);
+        }
+        fputc('\n', file);  // Newline after each row
+    }
+}
 
-            // Lock decoder access to safely process the decoder output
-            pthread_mutex_lock(&decoder_mutex);
-            while ((ret = avcodec_receive_frame(pCodecContext, frame)) == 0) {
-                clock_gettime(CLOCK_MONOTONIC, &receive_frame_start);
+// Cell grid reused across terminal renders; only the consumer thread or main renders to the terminal
+CellGrid terminal_cells;
 
-                // Use pre-allocated RGB frame from the pool
-                AVFrame *rgb_frame = frame_pool[producer_id][pool_index];
-                uint8_t *buffer = buffer_pool[producer_id][pool_index];
+// Print an already-sampled character grid; img_width/img_height are only used for the debug line
+void render_ascii_grid_terminal(const CachedPixel *grid, int target_width, int target_height, int img_width, int img_height, int term_rows, int term_cols, const char *char_set, int char_set_size, DebugInfo *debug_info) {
+    if (cell_grid_from_pixels(&terminal_cells, grid, target_width, target_height, char_set, char_set_size) != 0) {
+        fprintf(stderr, "Error: Failed to allocate render grid.\n");
+        return;
+    }
+    render_cell_grid_terminal(&terminal_cells, img_width, img_height, term_rows, term_cols, debug_info);
+}
 
-                // Convert the frame to RGB
-                clock_gettime(CLOCK_MONOTONIC, &convert_frame_start);
+// Scratch grid reused across frames; only the consumer thread or main renders to the terminal
+CachedPixel *terminal_scratch_grid(int target_width, int target_height) {
+    static CachedPixel *grid = NULL;
+    static size_t grid_capacity = 0;
+
+    size_t cell_count = (size_t)target_width * target_height;
+    if (cell_count > grid_capacity) {
+        CachedPixel *new_grid = realloc(grid, cell_count * sizeof(CachedPixel));
+        if (!new_grid) {
+            fprintf(stderr, "Error: Failed to allocate render grid.\n");
+            return NULL;
+        }
+        grid = new_grid;
+        grid_capacity = cell_count;
+    }
+    return grid;
+}
 
-                av_image_fill_arrays(rgb_frame->data, rgb_frame->linesize, buffer, AV_PIX_FMT_RGB24,
-                                     pCodecContext->width, pCodecContext->height, 32);
-                sws_scale(sws_ctx, (uint8_t const *const *) frame->data, frame->linesize, 0, pCodecContext->height,
-                          rgb_frame->data, rgb_frame->linesize);
+// Sample and print an image (or a sub-rectangle of one, via img_stride) to the terminal
+void render_ascii_art_terminal_strided(const CachedPixel *cached_img, int img_stride, int img_width, int img_height, int term_rows, int term_cols, const char *char_set, int char_set_size, DebugInfo *debug_info) {
+    int target_width, target_height;
+    compute_render_grid_size(img_width, img_height, term_rows, term_cols, &target_width, &target_height);
 
-                clock_gettime(CLOCK_MONOTONIC, &convert_frame_end);
-                convert_frame_total_time += (convert_frame_end.tv_sec - convert_frame_start.tv_sec) +
-                                            (convert_frame_end.tv_nsec - convert_frame_start.tv_nsec) / 1e9;
+    CachedPixel *grid = terminal_scratch_grid(target_width, target_height);
+    if (!grid) {
+        return;
+    }
 
-                // Lock the buffer and write frame to it
-                pthread_mutex_lock(&buffer_mutex);
+    sample_render_grid(cached_img, img_stride, img_width, img_height, grid, target_width, target_height);
+    render_ascii_grid_terminal(grid, target_width, target_height, img_width, img_height, term_rows, term_cols, char_set, char_set_size, debug_info);
+}
 
-                while (frame_buffer[current_buffer][buffer_write_index].is_ready) {
-                    pthread_cond_wait(&buffer_cond, &buffer_mutex);
-                }
+// Modify print function to move cursor back to the beginning instead of clearing
+void render_ascii_art_terminal(CachedPixel *cached_img, int img_width, int img_height, int term_rows, int term_cols, const char *char_set, int char_set_size, DebugInfo *debug_info) {
+    render_ascii_art_terminal_strided(cached_img, img_width, img_width, img_height, term_rows, term_cols, char_set, char_set_size, debug_info);
+}
 
-                // Cache grayscale values
-                clock_gettime(CLOCK_MONOTONIC, &cache_start);
+// Character grid of a frame_width x frame_height video frame at the current terminal size. Producers usually hand
+// over exactly that grid (cells_width x cells_height); a grid made before a resize, or a whole frame, is resampled
+// into the scratch grid. Returns NULL if the scratch grid cannot be allocated.
+const CachedPixel *frame_render_grid(const CachedPixel *cells, int cells_width, int cells_height, int frame_width, int frame_height,
+                                     int term_rows, int term_cols, int *grid_width, int *grid_height) {
+    compute_render_grid_size(frame_width, frame_height, term_rows, term_cols, grid_width, grid_height);
+    if (cells_width == *grid_width && cells_height == *grid_height) {
+        return cells;
+    }
 
-                frame_buffer[current_buffer][buffer_write_index].cached_img = cached_image_pool[producer_id][pool_index];
-                cache_grayscale_values(rgb_frame->data[0], pCodecContext->width, pCodecContext->height,
-                                       frame_buffer[current_buffer][buffer_write_index].cached_img);
+    CachedPixel *grid = terminal_scratch_grid(*grid_width, *grid_height);
+    if (grid) {
+        sample_render_grid(cells, cells_width, cells_width, cells_height, grid, *grid_width, *grid_height);
+    }
+    return grid;
+}
 
-                clock_gettime(CLOCK_MONOTONIC, &cache_end);
-                cache_total_time +=
-                        (cache_end.tv_sec - cache_start.tv_sec) + (cache_end.tv_nsec - cache_start.tv_nsec) / 1e9;
+// Summed-area table of a still image: entry (x, y) holds the channel sums of every pixel above and to the left, so
+// the exact average of any rectangle takes four lookups. Sums are 32-bit and wrap around; differences stay exact
+// while one rectangle sums to less than 2^32, which the still image pixel budget guarantees (255 * 16M < 2^32).
+typedef struct {
+    uint32_t r, g, b, gray;  // Same channel order as CachedPixel, so a pixel widens straight into one entry
+} AreaSum;
 
-                frame_buffer[current_buffer][buffer_write_index].frame = frame_pool[producer_id][pool_index];
-                frame_buffer[current_buffer][buffer_write_index].is_ready = 1;
+typedef struct {
+    AreaSum *sums;  // (width + 1) x (height + 1); the first row and column are zero
+    int width, height;
+} SummedAreaTable;
+
+// Build the table in one pass over the image, all four channels at once
+int build_summed_area_table(const CachedPixel *cached_img, int img_width, int img_height, SummedAreaTable *table) {
+    table->sums = NULL;
+    table->width = img_width;
+    table->height = img_height;
+    if ((uint64_t)img_width * img_height > STILL_IMAGE_PIXEL_BUDGET) {
+        return -1;
+    }
 
-                buffer_write_index = (buffer_write_index + 1) % BUFFER_POOL_SIZE;
+    size_t stride = (size_t)img_width + 1;
+    table->sums = malloc(stride * (img_height + 1) * sizeof(AreaSum));
+    if (!table->sums) {
+        return -1;
+    }
+    memset(table->sums, 0, stride * sizeof(AreaSum));
 
-                // Switch the buffer after filling all slots
-                if (buffer_write_index == 0) {
-                    current_buffer = 1 - current_buffer;
-                }
+    for (int y = 0; y < img_height; y++) {
+        const CachedPixel *row = cached_img + (size_t)y * img_width;
+        const AreaSum *above = table->sums + (size_t)y * stride;
+        AreaSum *sums = table->sums + (size_t)(y + 1) * stride;
+        sums[0] = (AreaSum){0, 0, 0, 0};
+
+#ifdef __SSE2__
+        // Widen each packed pixel to four 32-bit lanes and keep a running row sum in one register
+        const __m128i zero = _mm_setzero_si128();
+        __m128i running = zero;
+        for (int x = 0; x < img_width; x++) {
+            int packed;
+            memcpy(&packed, &row[x], sizeof(packed));
+            __m128i pixel = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+            running = _mm_add_epi32(running, pixel);
+            __m128i total = _mm_add_epi32(running, _mm_loadu_si128((const __m128i *)&above[x + 1]));
+            _mm_storeu_si128((__m128i *)&sums[x + 1], total);
+        }
+#else
+        uint32_t r = 0, g = 0, b = 0, gray = 0;
+        for (int x = 0; x < img_width; x++) {
+            r += row[x].r;
+            g += row[x].g;
+            b += row[x].b;
+            gray += row[x].gray_value;
+            sums[x + 1] = (AreaSum){above[x + 1].r + r, above[x + 1].g + g, above[x + 1].b + b, above[x + 1].gray + gray};
+        }
+#endif
+    }
+    return 0;
+}
 
-                pthread_cond_signal(&buffer_cond);
-                pthread_mutex_unlock(&buffer_mutex);
+void free_summed_area_table(SummedAreaTable *table) {
+    free(table->sums);
+    table->sums = NULL;
+}
 
-                pool_index = (pool_index + 1) % BUFFER_POOL_SIZE;
+// One character cell covering source pixels [x0, x1) x [y0, y1): the exact area average when a summed-area table
+// is available, otherwise the top-left pixel as before
+CachedPixel still_cell(const CachedPixel *cached_img, const SummedAreaTable *table, int img_width, int x0, int y0, int x1, int y1) {
+    if (!table || !table->sums) {
+        return cached_img[(size_t)y0 * img_width + x0];
+    }
 
-                clock_gettime(CLOCK_MONOTONIC, &receive_frame_end);
-                receive_frame_total_time += (receive_frame_end.tv_sec - receive_frame_start.tv_sec) +
-                                            (receive_frame_end.tv_nsec - receive_frame_start.tv_nsec) / 1e9;
+    // Cells narrower than a pixel (output larger than the image) still cover the pixel they start in
+    if (x1 <= x0) x1 = x0 + 1;
+    if (y1 <= y0) y1 = y0 + 1;
+
+    size_t stride = (size_t)table->width + 1;
+    const AreaSum *a = &table->sums[(size_t)y0 * stride + x0];
+    const AreaSum *b = &table->sums[(size_t)y0 * stride + x1];
+    const AreaSum *c = &table->sums[(size_t)y1 * stride + x0];
+    const AreaSum *d = &table->sums[(size_t)y1 * stride + x1];
+    uint32_t area = (uint32_t)(x1 - x0) * (uint32_t)(y1 - y0);
+    return (CachedPixel){
+        (uint8_t)((d->r - b->r - c->r + a->r) / area),
+        (uint8_t)((d->g - b->g - c->g + a->g) / area),
+        (uint8_t)((d->b - b->b - c->b + a->b) / area),
+        (uint8_t)((d->gray - b->gray - c->gray + a->gray) / area)
+    };
+}
 
-            }
-            pthread_mutex_unlock(&decoder_mutex);
-            if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
-                fprintf(stderr, "Error receiving frame from decoder: %s\n", av_err2str(ret));
+// Cell edges for count equal cells over extent pixels, as the samplers split them: edge i is i * extent / count
+void uniform_cell_edges(int extent, int count, int *edges) {
+    for (int i = 0; i <= count; i++) {
+        edges[i] = (int)((int64_t)i * extent / count);
+    }
+}
+
+// Fused downsample and luma from packed RGB24 into one averaged CachedPixel per cell: the source rows of each row of
+// cells are streamed once, colour and per-pixel luma are summed per cell, then every cell is divided out. The result
+// matches still_cell over a summed-area table, but no full-resolution CachedPixel copy is written or read. Glyphs are
+// picked from the averages later. Cell x spans source columns col_edges[x] to col_edges[x + 1] (likewise for rows);
+// a cell narrower than a pixel takes the pixel it starts in.
+// rgb_stride is the row length in bytes. Cell rows [first_row, last_row) are filled; sums holds one row of cells.
+static void rgb24_to_cell_rows(const uint8_t *rgb, size_t rgb_stride, const int *col_edges, const int *row_edges, CachedPixel *grid,
+                               int target_width, int first_row, int last_row, uint32_t *sums) {
+    for (int y = first_row; y < last_row; y++) {
+        int y0 = row_edges[y];
+        int y1 = row_edges[y + 1] > y0 ? row_edges[y + 1] : y0 + 1;
+        memset(sums, 0, (size_t)target_width * 4 * sizeof(uint32_t));
+
+        for (int source_y = y0; source_y < y1; source_y++) {
+            const uint8_t *row = rgb + (size_t)source_y * rgb_stride;
+            for (int x = 0; x < target_width; x++) {
+                int x0 = col_edges[x];
+                int x1 = col_edges[x + 1] > x0 ? col_edges[x + 1] : x0 + 1;
+                uint32_t r = 0, g = 0, b = 0, gray = 0;
+                for (const uint8_t *px = row + (size_t)x0 * 3, *end = row + (size_t)x1 * 3; px < end; px += 3) {
+                    r += px[0];
+                    g += px[1];
+                    b += px[2];
+                    gray += luma_from_rgb(px[0], px[1], px[2]);
+                }
+                uint32_t *sum = sums + (size_t)x * 4;
+                sum[0] += r;
+                sum[1] += g;
+                sum[2] += b;
+                sum[3] += gray;
             }
         }
-        av_packet_unref(packet);
 
-        clock_gettime(CLOCK_MONOTONIC, &producer_end_time);  // End profiling
-        producer_total_time += (producer_end_time.tv_sec - producer_start_time.tv_sec) + (producer_end_time.tv_nsec - producer_start_time.tv_nsec) / 1e9;
-        producer_frame_count++;
+        CachedPixel *cells = grid + (size_t)y * target_width;
+        for (int x = 0; x < target_width; x++) {
+            int x0 = col_edges[x];
+            int x1 = col_edges[x + 1] > x0 ? col_edges[x + 1] : x0 + 1;
+            uint32_t area = (uint32_t)(x1 - x0) * (uint32_t)(y1 - y0);
+            const uint32_t *sum = sums + (size_t)x * 4;
+            cells[x] = (CachedPixel){sum[0] / area, sum[1] / area, sum[2] / area, sum[3] / area};
+        }
     }
+}
 
-    pthread_mutex_lock(&buffer_mutex);
-    is_done = true; // Set the flag to indicate producer is done
-    pthread_cond_broadcast(&buffer_cond); // Notify all waiting consumers
-    pthread_mutex_unlock(&buffer_mutex);
+// rgb24_to_cell_rows over the whole grid. Large sources are split into one band of whole cell rows per thread, each
+// with its own row sums; every cell is summed by one thread in the same order, so the result does not depend on the
+// thread count. Returns -1 if the row sums cannot be allocated.
+int rgb24_to_cells(const uint8_t *rgb, size_t rgb_stride, const int *col_edges, const int *row_edges, CachedPixel *grid, int target_width, int target_height) {
+    int band_count = 1;
+#ifdef _OPENMP
+    size_t source_pixels = (size_t)(col_edges[target_width] - col_edges[0]) * (row_edges[target_height] - row_edges[0]);
+    if (source_pixels >= CACHE_PARALLEL_MIN_PIXELS) {
+        band_count = parallel_thread_count();
+        if (band_count > target_height) {
+            band_count = target_height;
+        }
+    }
+#endif
+    if (band_count < 1) {
+        band_count = 1;
+    }
 
-    av_frame_free(&frame);
-    av_packet_free(&packet);
-    sws_freeContext(sws_ctx);
+    size_t sums_length = (size_t)target_width * 4;
+    uint32_t *sums = malloc((size_t)band_count * sums_length * sizeof(uint32_t));
+    if (!sums) {
+        return -1;
+    }
 
-    // Store granular profiling results
-    producer_read_frame_total_time = read_frame_total_time;
-    producer_send_packet_total_time = send_packet_total_time;
-    producer_receive_frame_total_time = receive_frame_total_time;
-    producer_convert_frame_total_time = convert_frame_total_time;
+    if (band_count == 1) {
+        rgb24_to_cell_rows(rgb, rgb_stride, col_edges, row_edges, grid, target_width, 0, target_height, sums);
+    } else {
+        int rows_per_band = (target_height + band_count - 1) / band_count;
+        #pragma omp parallel for num_threads(band_count) schedule(static, 1)
+        for (int band = 0; band < band_count; band++) {
+            int first_row = band * rows_per_band;
+            int last_row = first_row + rows_per_band < target_height ? first_row + rows_per_band : target_height;
+            if (first_row < last_row) {
+                rgb24_to_cell_rows(rgb, rgb_stride, col_edges, row_edges, grid, target_width, first_row, last_row,
+                                   sums + (size_t)band * sums_length);
+            }
+        }
+    }
+
+    free(sums);
+    return 0;
+}
+
+// rgb24_to_cells over a whole image split into equal cells
+int rgb24_to_cell_grid(const uint8_t *rgb, size_t rgb_stride, int img_width, int img_height, CachedPixel *grid, int target_width, int target_height) {
+    int *edges = malloc(((size_t)target_width + target_height + 2) * sizeof(int));
+    if (!edges) {
+        return -1;
+    }
+    uniform_cell_edges(img_width, target_width, edges);
+    uniform_cell_edges(img_height, target_height, edges + target_width + 1);
+    int result = rgb24_to_cells(rgb, rgb_stride, edges, edges + target_width + 1, grid, target_width, target_height);
+    free(edges);
+    return result;
+}
+
+// Cache a converted video frame: reduced to a *grid_width x *grid_height character grid with the fused kernel, or
+// whole when the grid size is 0 or the kernel cannot allocate (the grid size is then set to 0). There is a single
+// producer, so both paths split large frames across the OpenMP threads rather than converting on its core alone.
+void cache_frame_cells(const AVFrame *rgb_frame, CachedPixel *cells, int *grid_width, int *grid_height) {
+    if (*grid_width > 0 && rgb24_to_cell_grid(rgb_frame->data[0], rgb_frame->linesize[0], rgb_frame->width, rgb_frame->height,
+                                              cells, *grid_width, *grid_height) == 0) {
+        return;
+    }
+    *grid_width = *grid_height = 0;
+    cache_grayscale_values(rgb_frame->data[0], rgb_frame->width, rgb_frame->height, cells);
+}
+
+// Fill cells from a still image with the given edges: with the fused kernel when the decoded RGB is at hand,
+// otherwise one still_cell per cell from the cache. Returns -1 if the fused kernel runs out of memory.
+int sample_still_cells(const uint8_t *rgb, const CachedPixel *cached_img, const SummedAreaTable *table, int img_width,
+                        const int *col_edges, const int *row_edges, CachedPixel *grid, int target_width, int target_height) {
+    if (rgb) {
+        return rgb24_to_cells(rgb, (size_t)img_width * 3, col_edges, row_edges, grid, target_width, target_height);
+    }
+    for (int y = 0; y < target_height; y++) {
+        for (int x = 0; x < target_width; x++) {
+            grid[(size_t)y * target_width + x] = still_cell(cached_img, table, img_width, col_edges[x], row_edges[y],
+                                                            col_edges[x + 1], row_edges[y + 1]);
+        }
+    }
+    return 0;
+}
+
+// Mip pyramid of a still image: level 0 is the image itself, each further level halves the previous one
+// with a 2x2 box filter. Re-rendering reads the smallest level that still has a pixel for every character cell,
+// so resizes and zooms cost time in proportion to the grid and each cell averages the pixels it covers.
+#define MIP_MAX_LEVELS 32
+
+typedef struct {
+    CachedPixel *pixels[MIP_MAX_LEVELS];  // Level 0 belongs to the caller
+    int width[MIP_MAX_LEVELS];
+    int height[MIP_MAX_LEVELS];
+    int level_count;
+} MipPyramid;
+
+// Build levels down to a single row or column; the extra levels add a third to the image's memory
+void build_mip_pyramid(CachedPixel *cached_img, int img_width, int img_height, MipPyramid *pyramid) {
+    memset(pyramid, 0, sizeof(*pyramid));
+    pyramid->pixels[0] = cached_img;
+    pyramid->width[0] = img_width;
+    pyramid->height[0] = img_height;
+    pyramid->level_count = 1;
+
+    while (pyramid->level_count < MIP_MAX_LEVELS) {
+        int level = pyramid->level_count;
+        int src_width = pyramid->width[level - 1], src_height = pyramid->height[level - 1];
+        if (src_width < 2 || src_height < 2) {
+            break;
+        }
+
+        // Odd sizes round up: the last column or row averages the one source pixel left, counted twice so the
+        // 2x2 average below still holds
+        int width = (src_width + 1) / 2, height = (src_height + 1) / 2;
+        CachedPixel *pixels = malloc((size_t)width * height * sizeof(CachedPixel));
+        if (!pixels) {
+            break;  // Render from the levels built so far
+        }
+
+        const CachedPixel *src = pyramid->pixels[level - 1];
+        for (int y = 0; y < height; y++) {
+            const CachedPixel *row0 = src + (size_t)(2 * y) * src_width;
+            const CachedPixel *row1 = 2 * y + 1 < src_height ? row0 + src_width : row0;
+            for (int x = 0; x < width; x++) {
+                int x1 = 2 * x + 1 < src_width ? 2 * x + 1 : 2 * x;
+                const CachedPixel *a = row0 + 2 * x, *b = row0 + x1, *c = row1 + 2 * x, *d = row1 + x1;
+                pixels[(size_t)y * width + x] = (CachedPixel){
+                    (a->r + b->r + c->r + d->r + 2) / 4,
+                    (a->g + b->g + c->g + d->g + 2) / 4,
+                    (a->b + b->b + c->b + d->b + 2) / 4,
+                    (a->gray_value + b->gray_value + c->gray_value + d->gray_value + 2) / 4
+                };
+            }
+        }
+
+        pyramid->pixels[level] = pixels;
+        pyramid->width[level] = width;
+        pyramid->height[level] = height;
+        pyramid->level_count++;
+    }
+}
+
+void free_mip_pyramid(MipPyramid *pyramid) {
+    for (int level = 1; level < pyramid->level_count; level++) {
+        free(pyramid->pixels[level]);
+    }
+    memset(pyramid, 0, sizeof(*pyramid));
+}
+
+// Render the view of a still image from the smallest pyramid level whose region still covers the character grid.
+// The pyramid may hold a
+// preview or a reduced copy; source_width/height is the full image, which sets the grid shape. An incremental
+// render repaints only the cells that changed since the last one.
+void render_ascii_art_terminal_still(const MipPyramid *pyramid, int source_width, int source_height, const ViewRegion *view, int term_rows, int term_cols, const char *char_set, int char_set_size, DebugInfo *debug_info, bool incremental) {
+    PixelRect source_rect, rect;
+    view_region_to_rect(view, source_width, source_height, 0, 0, &source_rect);
+    view_region_to_rect(view, pyramid->width[0], pyramid->height[0], 0, 0, &rect);
+
+    // The grid shape comes from the full-resolution region so it does not shift between levels
+    int target_width, target_height;
+    compute_render_grid_size(source_rect.width, source_rect.height, term_rows, term_cols, &target_width, &target_height);
+
+    CachedPixel *grid = terminal_scratch_grid(target_width, target_height);
+    if (!grid) {
+        return;
+    }
+
+    int level = 0;
+    while (level + 1 < pyramid->level_count) {
+        PixelRect next;
+        view_region_to_rect(view, pyramid->width[level + 1], pyramid->height[level + 1], 0, 0, &next);
+        if (next.width < target_width || next.height < target_height) {
+            break;
+        }
+        rect = next;
+        level++;
+    }
+
+    int stride = pyramid->width[level];
+    sample_render_grid(pyramid->pixels[level] + (size_t)rect.y * stride + rect.x, stride, rect.width, rect.height,
+                       grid, target_width, target_height);
+
+    if (cell_grid_from_pixels(&terminal_cells, grid, target_width, target_height, char_set, char_set_size) != 0) {
+        fprintf(stderr, "Error: Failed to allocate render grid.\n");
+        return;
+    }
+    if (incremental) {
+        render_cell_grid_terminal_diff(&terminal_cells, source_rect.width, source_rect.height, term_rows, term_cols, debug_info);
+    } else {
+        render_cell_grid_terminal(&terminal_cells, source_rect.width, source_rect.height, term_rows, term_cols, debug_info);
+        remember_painted_grid(&terminal_cells);
+    }
+}
+
+#define GLYPH_ROW_ALIGN 8  // Glyph rows are padded to whole AVX2 vectors of pixels
+
+// One rasterized glyph inside a GlyphAtlas
+typedef struct {
+    size_t offset;      // Start of its coverage bitmap in the atlas
+    int width, height;  // Bitmap size; 0 x 0 for blank glyphs
+    int stride;         // Bytes per bitmap row: the width padded with zero coverage to GLYPH_ROW_ALIGN
+    uint8_t levels[32];  // Bit set of the coverage values it contains, for predicting blended colours
+} AtlasGlyph;
+
+// Coverage bitmaps of every glyph of a character set, rasterized once and packed back to back so rendering
+// blits from one buffer instead of rasterizing (and allocating) per cell
+typedef struct {
+    unsigned char *coverage;
+    AtlasGlyph *glyphs;  // Indexed like the character set
+    int glyph_count;
+    int max_width;
+    int max_height;  // Tallest glyph, for overhang into the cell rows below
+} GlyphAtlas;
+
+void free_glyph_atlas(GlyphAtlas *atlas) {
+    free(atlas->coverage);
+    free(atlas->glyphs);
+    memset(atlas, 0, sizeof(*atlas));
+}
+
+// Rasterize each glyph of char_set at pixel_height with stb_truetype
+int build_glyph_atlas(GlyphAtlas *atlas, const char *char_set, int char_set_size, float pixel_height) {
+    memset(atlas, 0, sizeof(*atlas));
+    if (!font.data) {
+        fprintf(stderr, "Error: No font loaded for glyph rendering.\n");
+        return -1;
+    }
+
+    float scale_factor = stbtt_ScaleForPixelHeight(&font, pixel_height);
+    unsigned char *bitmaps[256] = {0};
+    atlas->glyphs = calloc(char_set_size, sizeof(AtlasGlyph));
+    if (!atlas->glyphs || char_set_size > 256) {
+        free_glyph_atlas(atlas);
+        return -1;
+    }
+    atlas->glyph_count = char_set_size;
+
+    size_t total_size = 0;
+    for (int i = 0; i < char_set_size; i++) {
+        AtlasGlyph *glyph = &atlas->glyphs[i];
+        if (char_set[i] == ' ') {
+            continue;
+        }
+        int x_offset, y_offset;
+        bitmaps[i] = stbtt_GetCodepointBitmap(&font, 0, scale_factor, char_set[i], &glyph->width, &glyph->height,
+                                              &x_offset, &y_offset);
+        if (!bitmaps[i]) {
+            glyph->width = glyph->height = 0;
+        }
+        glyph->offset = total_size;
+        if (glyph->width > atlas->max_width) {
+            atlas->max_width = glyph->width;
+        }
+        if (glyph->height > atlas->max_height) {
+            atlas->max_height = glyph->height;
+        }
+        glyph->stride = (glyph->width + GLYPH_ROW_ALIGN - 1) & ~(GLYPH_ROW_ALIGN - 1);
+        total_size += (size_t)glyph->stride * glyph->height;
+    }
+
+    atlas->coverage = calloc(total_size + 1, 1);
+    for (int i = 0; i < char_set_size; i++) {
+        if (bitmaps[i]) {
+            if (atlas->coverage) {
+                AtlasGlyph *glyph = &atlas->glyphs[i];
+                for (int row = 0; row < glyph->height; row++) {
+                    memcpy(atlas->coverage + glyph->offset + (size_t)row * glyph->stride,
+                           bitmaps[i] + (size_t)row * glyph->width, glyph->width);
+                }
+                size_t size = (size_t)glyph->width * glyph->height;
+                for (size_t k = 0; k < size; k++) {
+                    glyph->levels[bitmaps[i][k] >> 3] |= 1 << (bitmaps[i][k] & 7);
+                }
+            }
+            stbtt_FreeBitmap(bitmaps[i], NULL);
+        }
+    }
+    if (!atlas->coverage) {
+        free_glyph_atlas(atlas);
+        return -1;
+    }
+    return 0;
+}
+
+// x / 255, rounded, for x in 0..65025
+static inline int div255(int x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// Coverage-weighted mix of a glyph colour over what is under it; coverage 255 gives fg, 0 leaves bg
+static inline uint8_t blend_channel(int fg, int bg, int coverage) {
+    return (uint8_t)div255(fg * coverage + bg * (255 - coverage));
+}
+
+// Blend count RGBA pixels towards color (0xAABBGGRR in memory order) by their coverage bytes, one at a time
+static void blend_glyph_span_scalar(unsigned char *pixels, const unsigned char *coverage, int count, uint32_t color) {
+    const unsigned char *fg = (const unsigned char *)&color;
+    for (int i = 0; i < count; i++) {
+        int a = coverage[i];
+        if (a) {
+            for (int c = 0; c < 4; c++) {
+                pixels[i * 4 + c] = blend_channel(fg[c], pixels[i * 4 + c], a);
+            }
+        }
+    }
+}
+
+#ifdef __SSE2__
+// Blend two pixels held as 16-bit channels
+static inline __m128i blend_epi16_sse2(__m128i dst, __m128i fg, __m128i a) {
+    const __m128i bias = _mm_set1_epi16(128), full = _mm_set1_epi16(255);
+    __m128i t = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(fg, a), _mm_mullo_epi16(dst, _mm_sub_epi16(full, a))), bias);
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+// Four pixels per vector, with the same rounding as the scalar version
+static void blend_glyph_span_sse2(unsigned char *pixels, const unsigned char *coverage, int count, uint32_t color) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i fg = _mm_unpacklo_epi8(_mm_set1_epi32((int)color), zero);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        uint32_t four;
+        memcpy(&four, coverage + i, 4);
+        if (!four) {
+            continue;
+        }
+        __m128i a = _mm_cvtsi32_si128((int)four);
+        a = _mm_unpacklo_epi8(a, a);
+        a = _mm_unpacklo_epi16(a, a);  // Each coverage byte repeated for the pixel's four channels
+        __m128i dst = _mm_loadu_si128((const __m128i *)(pixels + i * 4));
+        __m128i lo = blend_epi16_sse2(_mm_unpacklo_epi8(dst, zero), fg, _mm_unpacklo_epi8(a, zero));
+        __m128i hi = blend_epi16_sse2(_mm_unpackhi_epi8(dst, zero), fg, _mm_unpackhi_epi8(a, zero));
+        _mm_storeu_si128((__m128i *)(pixels + i * 4), _mm_packus_epi16(lo, hi));
+    }
+    blend_glyph_span_scalar(pixels + i * 4, coverage + i, count - i, color);
+}
+#endif
+
+#ifdef PIXEL_SPAN_X86_DISPATCH
+__attribute__((target("avx2")))
+static inline __m256i blend_epi16_avx2(__m256i dst, __m256i fg, __m256i a) {
+    const __m256i bias = _mm256_set1_epi16(128), full = _mm256_set1_epi16(255);
+    __m256i t = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(fg, a), _mm256_mullo_epi16(dst, _mm256_sub_epi16(full, a))), bias);
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+// Eight pixels per vector
+__attribute__((target("avx2")))
+static void blend_glyph_span_avx2(unsigned char *pixels, const unsigned char *coverage, int count, uint32_t color) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i fg = _mm256_unpacklo_epi8(_mm256_set1_epi32((int)color), zero);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint64_t eight;
+        memcpy(&eight, coverage + i, 8);
+        if (!eight) {
+            continue;
+        }
+        __m128i a = _mm_cvtsi64_si128((long long)eight);
+        a = _mm_unpacklo_epi8(a, a);
+        __m256i spread = _mm256_set_m128i(_mm_unpackhi_epi16(a, a), _mm_unpacklo_epi16(a, a));
+        __m256i dst = _mm256_loadu_si256((const __m256i *)(pixels + i * 4));
+        __m256i lo = blend_epi16_avx2(_mm256_unpacklo_epi8(dst, zero), fg, _mm256_unpacklo_epi8(spread, zero));
+        __m256i hi = blend_epi16_avx2(_mm256_unpackhi_epi8(dst, zero), fg, _mm256_unpackhi_epi8(spread, zero));
+        _mm256_storeu_si256((__m256i *)(pixels + i * 4), _mm256_packus_epi16(lo, hi));
+    }
+    blend_glyph_span_scalar(pixels + i * 4, coverage + i, count - i, color);
+}
+#endif
+
+typedef void (*GlyphSpanFunction)(unsigned char *pixels, const unsigned char *coverage, int count, uint32_t color);
+
+// Blending variants, slowest first; all produce identical output
+static const struct {
+    const char *name;
+    GlyphSpanFunction blend;
+    bool (*supported)(void);  // NULL if the build target already guarantees the instructions
+} glyph_span_variants[] = {
+    {"scalar", blend_glyph_span_scalar, NULL},
+#ifdef __SSE2__
+    {"sse2", blend_glyph_span_sse2, NULL},
+#endif
+#ifdef PIXEL_SPAN_X86_DISPATCH
+    {"avx2", blend_glyph_span_avx2, cpu_has_avx2},
+#endif
+};
+
+static GlyphSpanFunction blend_glyph_span = blend_glyph_span_scalar;
+static pthread_once_t glyph_span_once = PTHREAD_ONCE_INIT;
+
+static void select_glyph_span_variant(void) {
+#ifdef PIXEL_SPAN_X86_DISPATCH
+    __builtin_cpu_init();
+#endif
+    for (size_t variant = 0; variant < sizeof(glyph_span_variants) / sizeof(glyph_span_variants[0]); variant++) {
+        if (!glyph_span_variants[variant].supported || glyph_span_variants[variant].supported()) {
+            blend_glyph_span = glyph_span_variants[variant].blend;
+        }
+    }
+}
+
+// Helper function to blend one glyph of the atlas over the image with its top-left corner at (x, y), using the
+// glyph's coverage as alpha. The glyph is clipped once to the image width and the output rows
+// [clip_top, clip_bottom); output_img holds only those rows, starting with clip_top.
+void render_ascii_to_image(unsigned char *output_img, int x, int y, const GlyphAtlas *atlas, int glyph_index, int img_width, int clip_top, int clip_bottom, int r, int g, int b) {
+    const AtlasGlyph *glyph = &atlas->glyphs[glyph_index];
+    int left = x > 0 ? 0 : -x, right = x + glyph->width < img_width ? glyph->width : img_width - x;
+    int top = y < clip_top ? clip_top - y : 0, bottom = y + glyph->height < clip_bottom ? glyph->height : clip_bottom - y;
+    if (left >= right || top >= bottom) {
+        return;
+    }
+
+    // Zero coverage leaves a pixel as it is, so where the image is wide enough the padded rows are blended whole
+    int span = right - left;
+    if (left == 0 && x + glyph->stride <= img_width) {
+        span = glyph->stride;
+    }
+
+    pthread_once(&glyph_span_once, select_glyph_span_variant);
+    unsigned char fg[4] = {r, g, b, 255};
+    uint32_t color;
+    memcpy(&color, fg, 4);
+    for (int i = top; i < bottom; i++) {
+        unsigned char *row = output_img + ((size_t)(y + i - clip_top) * img_width + x + left) * 4;
+        blend_glyph_span(row, atlas->coverage + glyph->offset + (size_t)i * glyph->stride + left, span, color);
+    }
+}
+
+// Image serializer for the output rows [band_top, band_bottom): paint each cell's background (black unless the grid
+// has colours for it), then its glyph in the foreground colour, one cell every cell_size pixels of the RGBA output.
+// Glyphs from cell rows above the band that reach down into it are drawn too, clipped to the band, so every pixel
+// ends up as in a paint of the whole image. Glyphs come from atlas, built for the grid's character set. band_img
+// holds just the band's rows.
+void draw_cell_grid_band(const CellGrid *grid, const GlyphAtlas *atlas, unsigned char *band_img, int img_width, int cell_size, int band_top, int band_bottom) {
+    for (size_t i = 0; i < (size_t)(band_bottom - band_top) * img_width * 4; i += 4) {
+        band_img[i] = 0;     // Red
+        band_img[i + 1] = 0; // Green
+        band_img[i + 2] = 0; // Blue
+        band_img[i + 3] = 255; // Alpha (fully opaque)
+    }
+
+    int first_row = band_top / cell_size;
+    int last_row = (band_bottom - 1) / cell_size;
+    if (last_row >= grid->height) {
+        last_row = grid->height - 1;
+    }
+
+    if (grid->bg) {
+        for (int y = first_row; y <= last_row; y++) {
+            int top = y * cell_size > band_top ? y * cell_size : band_top;
+            int bottom = (y + 1) * cell_size < band_bottom ? (y + 1) * cell_size : band_bottom;
+            for (int x = 0; x < grid->width; x++) {
+                CellColor bg = grid->bg[(size_t)y * grid->width + x];
+                for (int py = top; py < bottom; py++) {
+                    for (int px = x * cell_size; px < (x + 1) * cell_size && px < img_width; px++) {
+                        unsigned char *out = band_img + ((size_t)(py - band_top) * img_width + px) * 4;
+                        out[0] = bg.r;
+                        out[1] = bg.g;
+                        out[2] = bg.b;
+                    }
+                }
+            }
+        }
+    }
+
+    // A glyph taller than its cell overhangs the rows below
+    int overhang_rows = atlas->max_height > cell_size ? (atlas->max_height - 1) / cell_size : 0;
+    for (int y = first_row - overhang_rows > 0 ? first_row - overhang_rows : 0; y <= last_row; y++) {
+        for (int x = 0; x < grid->width; x++) {
+            size_t i = (size_t)y * grid->width + x;
+            if (cell_char(grid, i) != ' ') {
+                CellColor fg = grid->cells[i].fg;
+                render_ascii_to_image(band_img, x * cell_size, y * cell_size, atlas, grid->cells[i].glyph,
+                                      img_width, band_top, band_bottom, fg.r, fg.g, fg.b);
+            }
+        }
+    }
+}
+
+// Paint the output rows [top, bottom) into band_img; top falls on a cell row. Large bands are split further into
+// one band of whole cell rows per thread.
+void draw_cell_grid_rows(const CellGrid *grid, const GlyphAtlas *atlas, unsigned char *band_img, int img_width, int cell_size, int top, int bottom) {
+    int cell_rows = (bottom - top + cell_size - 1) / cell_size;
+    int band_count = 1;
+#ifdef _OPENMP
+    if ((size_t)img_width * (bottom - top) >= RASTER_PARALLEL_MIN_PIXELS) {
+        band_count = parallel_thread_count();
+        if (band_count > cell_rows) {
+            band_count = cell_rows;
+        }
+    }
+#endif
+    if (band_count <= 1) {
+        draw_cell_grid_band(grid, atlas, band_img, img_width, cell_size, top, bottom);
+        return;
+    }
+
+    int rows_per_band = (cell_rows + band_count - 1) / band_count;
+    #pragma omp parallel for num_threads(band_count) schedule(static, 1)
+    for (int band = 0; band < band_count; band++) {
+        int band_top = top + band * rows_per_band * cell_size;
+        int band_bottom = top + (band + 1) * rows_per_band * cell_size;
+        if (band_bottom > bottom) {
+            band_bottom = bottom;
+        }
+        if (band_top < band_bottom) {
+            draw_cell_grid_band(grid, atlas, band_img + (size_t)(band_top - top) * img_width * 4, img_width, cell_size,
+                                band_top, band_bottom);
+        }
+    }
+}
+
+#define PALETTE_HASH_SIZE 1024  // Power of two, well above the 256 palette entries
+
+// Up to 256 colours (0xRRGGBB) with a hash from colour to index, for indexed PNG output
+typedef struct {
+    uint32_t colors[256];
+    int size;
+    uint32_t keys[PALETTE_HASH_SIZE];  // Colour + 1; 0 marks an empty slot
+    uint8_t indexes[PALETTE_HASH_SIZE];
+} Palette;
+
+static inline uint32_t palette_slot(uint32_t color) {
+    return (color * 2654435761u) >> 22;  // Top 10 bits of a multiplicative hash
+}
+
+static inline int palette_find(const Palette *palette, uint32_t color) {
+    for (uint32_t slot = palette_slot(color);; slot = (slot + 1) & (PALETTE_HASH_SIZE - 1)) {
+        if (palette->keys[slot] == color + 1) {
+            return palette->indexes[slot];
+        }
+        if (palette->keys[slot] == 0) {
+            return -1;
+        }
+    }
+}
+
+// Returns false once the palette is full
+static bool palette_add(Palette *palette, uint32_t color) {
+    uint32_t slot = palette_slot(color);
+    while (palette->keys[slot] != 0) {
+        if (palette->keys[slot] == color + 1) {
+            return true;
+        }
+        slot = (slot + 1) & (PALETTE_HASH_SIZE - 1);
+    }
+    if (palette->size == 256) {
+        return false;
+    }
+    palette->keys[slot] = color + 1;
+    palette->indexes[slot] = palette->size;
+    palette->colors[palette->size++] = color;
+    return true;
+}
+
+static inline uint32_t cell_color_value(CellColor color) {
+    return (uint32_t)color.r << 16 | color.g << 8 | color.b;
+}
+
+// Collect every colour a drawing of the grid can contain: black, the backgrounds, and each coverage level of every
+// visible glyph blended over its cell's background. Returns false if there are more than 256, or if glyphs are
+// larger than a cell, since overlapping glyphs blend into colours that cannot be predicted per cell.
+bool cell_grid_palette(const CellGrid *grid, const GlyphAtlas *atlas, int cell_size, Palette *palette) {
+    memset(palette, 0, sizeof(*palette));
+    if (atlas->max_width > cell_size || atlas->max_height > cell_size) {
+        return false;
+    }
+    palette_add(palette, 0);
+    size_t cell_count = (size_t)grid->width * grid->height;
+    size_t previous = SIZE_MAX;  // Last cell whose colours were added; runs of equal cells are skipped
+    for (size_t i = 0; i < cell_count; i++) {
+        CellColor bg = cell_background(grid, i), fg = grid->cells[i].fg;
+        if (previous != SIZE_MAX && grid->cells[i].glyph == grid->cells[previous].glyph && cells_equal(grid, i, grid, previous)) {
+            continue;
+        }
+        previous = i;
+        if (!palette_add(palette, cell_color_value(bg))) {
+            return false;
+        }
+        if (cell_char(grid, i) == ' ') {
+            continue;
+        }
+        const uint8_t *levels = atlas->glyphs[grid->cells[i].glyph].levels;
+        for (int level = 1; level < 256; level++) {
+            if (levels[level >> 3] & 1 << (level & 7)) {
+                CellColor mixed = {blend_channel(fg.r, bg.r, level), blend_channel(fg.g, bg.g, level),
+                                   blend_channel(fg.b, bg.b, level)};
+                if (!palette_add(palette, cell_color_value(mixed))) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+#define PNG_DEFLATE_CHUNK (256 * 1024)  // Filtered bytes each thread deflates on its own
+#define PNG_DEFLATE_WINDOW 32768        // Bytes of history that prime the next chunk's dictionary
+
+// An image file being written a band of rows at a time. Rows arrive as RGBA; every format stores RGB.
+typedef struct {
+    FILE *file;
+    OutputFormat format;
+    int width, height;
+    size_t row_bytes;  // RGB bytes per row
+    bool failed;
+    unsigned char *scratch;  // Rows repacked for the format
+    size_t scratch_size;
+
+    // PNG: rows are filtered, then deflated in independent chunks joined by sync flushes. With a palette the rows
+    // are written as indexes of bit_depth bits instead of RGB.
+    const Palette *palette;
+    int bit_depth;
+    unsigned char *previous_row;  // Last RGB row of the previous band, for the Up, Average and Paeth filters
+    unsigned char *filtered;      // Filtered rows of the current band, each led by its filter type byte
+    unsigned char *compressed;    // One output slot per chunk, each led by "IDAT"
+    size_t filtered_size, compressed_size;
+    unsigned char history[PNG_DEFLATE_WINDOW];
+    size_t history_size;
+    uLong adler;
+
+    // QOI
+    unsigned char qoi_index[64][4];  // RGBA, so slots never written (alpha 0) never match
+    unsigned char qoi_previous[3];
+    int qoi_run;
+
+    // JPEG: stb only encodes a complete image, so the rows are gathered first
+    unsigned char *canvas;
+    int rows_written;
+} ImageStream;
+
+// Grow a buffer to hold at least size bytes
+static unsigned char *image_stream_buffer(ImageStream *stream, unsigned char **buffer, size_t *capacity, size_t size) {
+    if (size > *capacity) {
+        unsigned char *grown = realloc(*buffer, size);
+        if (!grown) {
+            stream->failed = true;
+            return NULL;
+        }
+        *buffer = grown;
+        *capacity = size;
+    }
+    return *buffer;
+}
+
+// Drop the alpha byte of row_count RGBA rows into the scratch buffer
+static unsigned char *pack_rgb_rows(ImageStream *stream, const unsigned char *rows, int row_count) {
+    unsigned char *packed = image_stream_buffer(stream, &stream->scratch, &stream->scratch_size, stream->row_bytes * row_count);
+    if (!packed) {
+        return NULL;
+    }
+    size_t pixel_count = (size_t)stream->width * row_count;
+    for (size_t i = 0; i < pixel_count; i++) {
+        packed[i * 3] = rows[i * 4];
+        packed[i * 3 + 1] = rows[i * 4 + 1];
+        packed[i * 3 + 2] = rows[i * 4 + 2];
+    }
+    return packed;
+}
+
+static void put_u32_be(unsigned char *out, uint32_t value) {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+static void put_u32_le(unsigned char *out, uint32_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+    out[2] = value >> 16;
+    out[3] = value >> 24;
+}
+
+// data starts with the 4-byte chunk type
+static void png_write_chunk(ImageStream *stream, const unsigned char *data, size_t data_size) {
+    unsigned char word[4];
+    put_u32_be(word, (uint32_t)(data_size - 4));
+    fwrite(word, 1, 4, stream->file);
+    fwrite(data, 1, data_size, stream->file);
+    put_u32_be(word, (uint32_t)crc32(0, data, (uInt)data_size));
+    if (fwrite(word, 1, 4, stream->file) != 4) {
+        stream->failed = true;
+    }
+}
+
+static int png_open(ImageStream *stream) {
+    const Palette *palette = stream->palette;
+    if (palette) {
+        stream->bit_depth = palette->size <= 2 ? 1 : palette->size <= 4 ? 2 : palette->size <= 16 ? 4 : 8;
+        stream->row_bytes = ((size_t)stream->width * stream->bit_depth + 7) / 8;
+    }
+    stream->previous_row = calloc(stream->row_bytes, 1);
+    if (!stream->previous_row) {
+        return -1;
+    }
+    stream->adler = adler32(0, NULL, 0);
+
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    fwrite(signature, 1, sizeof(signature), stream->file);
+    unsigned char header[17] = {'I', 'H', 'D', 'R'};
+    put_u32_be(header + 4, (uint32_t)stream->width);
+    put_u32_be(header + 8, (uint32_t)stream->height);
+    header[12] = palette ? stream->bit_depth : 8;  // Bits per index or channel
+    header[13] = palette ? 3 : 2;                  // Indexed colour or truecolour
+    png_write_chunk(stream, header, sizeof(header));
+
+    if (palette) {
+        unsigned char entries[4 + 256 * 3] = {'P', 'L', 'T', 'E'};
+        for (int i = 0; i < palette->size; i++) {
+            entries[4 + i * 3] = palette->colors[i] >> 16;
+            entries[4 + i * 3 + 1] = palette->colors[i] >> 8;
+            entries[4 + i * 3 + 2] = palette->colors[i];
+        }
+        png_write_chunk(stream, entries, 4 + (size_t)palette->size * 3);
+    }
+
+    // zlib header; the compressed chunks that follow are raw deflate
+    int level = png_compression_level;
+    unsigned char zlib_header[6] = {'I', 'D', 'A', 'T', 0x78, (level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6};
+    zlib_header[5] += 31 - ((zlib_header[4] << 8 | zlib_header[5]) % 31);
+    png_write_chunk(stream, zlib_header, sizeof(zlib_header));
+    return 0;
+}
+
+static inline unsigned char png_paeth(int a, int b, int c) {
+    int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+// Filter one row the way that gives the smallest sum of absolute signed bytes (no filtering when the data is
+// stored uncompressed anyway), writing the type byte and the row
+static void png_filter_row(const unsigned char *row, const unsigned char *up, size_t row_bytes, unsigned char *out) {
+    int best = 0;
+    if (png_compression_level > 0) {
+        unsigned long sums[5] = {0};
+        for (size_t i = 0; i < row_bytes; i++) {
+            int left = i >= 3 ? row[i - 3] : 0, up_left = i >= 3 ? up[i - 3] : 0;
+            sums[0] += abs((signed char)row[i]);
+            sums[1] += abs((signed char)(row[i] - left));
+            sums[2] += abs((signed char)(row[i] - up[i]));
+            sums[3] += abs((signed char)(row[i] - ((left + up[i]) >> 1)));
+            sums[4] += abs((signed char)(row[i] - png_paeth(left, up[i], up_left)));
+        }
+        for (int type = 1; type < 5; type++) {
+            if (sums[type] < sums[best]) {
+                best = type;
+            }
+        }
+    }
+
+    out[0] = best;
+    out++;
+    switch (best) {
+        case 0:
+            memcpy(out, row, row_bytes);
+            break;
+        case 1:
+            for (size_t i = 0; i < row_bytes; i++) {
+                out[i] = row[i] - (i >= 3 ? row[i - 3] : 0);
+            }
+            break;
+        case 2:
+            for (size_t i = 0; i < row_bytes; i++) {
+                out[i] = row[i] - up[i];
+            }
+            break;
+        case 3:
+            for (size_t i = 0; i < row_bytes; i++) {
+                out[i] = row[i] - (((i >= 3 ? row[i - 3] : 0) + up[i]) >> 1);
+            }
+            break;
+        default:
+            for (size_t i = 0; i < row_bytes; i++) {
+                out[i] = row[i] - (i >= 3 ? png_paeth(row[i - 3], up[i], up[i - 3]) : png_paeth(0, up[i], 0));
+            }
+            break;
+    }
+}
+
+// Write one RGBA row as palette indexes packed bit_depth bits at a time, high bits first, after filter type 0
+static void png_index_row(const ImageStream *stream, const unsigned char *row, unsigned char *out) {
+    int depth = stream->bit_depth, per_byte = 8 / depth;
+    *out++ = 0;
+    memset(out, 0, stream->row_bytes);
+    uint32_t last_color = 0;
+    int last_index = palette_find(stream->palette, 0);
+    for (int x = 0; x < stream->width; x++) {
+        uint32_t color = (uint32_t)row[x * 4] << 16 | row[x * 4 + 1] << 8 | row[x * 4 + 2];
+        if (color != last_color) {
+            last_color = color;
+            last_index = palette_find(stream->palette, color);
+            if (last_index < 0) {
+                last_index = 0;  // Not drawn from the grid's colours; cannot happen
+            }
+        }
+        out[x / per_byte] |= last_index << (8 - depth - (x % per_byte) * depth);
+    }
+}
+
+// Filter the band's rows and deflate them on all threads. Each chunk is compressed on its own, primed with the
+// 32 KB before it as dictionary, and ends in a sync flush, so the chunks concatenate into one deflate stream.
+static void png_write_rows(ImageStream *stream, const unsigned char *rows, int row_count) {
+    const unsigned char *packed = stream->palette ? rows : pack_rgb_rows(stream, rows, row_count);
+    size_t filtered_row = stream->row_bytes + 1, size = filtered_row * row_count;
+    int chunk_count = (int)((size + PNG_DEFLATE_CHUNK - 1) / PNG_DEFLATE_CHUNK);
+    size_t slot_size = 4 + compressBound(PNG_DEFLATE_CHUNK) + 16;
+    size_t *chunk_sizes = calloc(chunk_count, sizeof(size_t));
+    if (!packed || !chunk_sizes ||
+        !image_stream_buffer(stream, &stream->filtered, &stream->filtered_size, size) ||
+        !image_stream_buffer(stream, &stream->compressed, &stream->compressed_size, slot_size * chunk_count)) {
+        stream->failed = true;
+        free(chunk_sizes);
+        return;
+    }
+
+    if (stream->palette) {
+        // Indexed rows are left unfiltered, as filters rarely help palette images
+        #pragma omp parallel for num_threads(parallel_thread_count()) schedule(static) if(size >= PNG_DEFLATE_CHUNK)
+        for (int y = 0; y < row_count; y++) {
+            png_index_row(stream, rows + (size_t)y * stream->width * 4, stream->filtered + y * filtered_row);
+        }
+    } else {
+        #pragma omp parallel for num_threads(parallel_thread_count()) schedule(static) if(size >= PNG_DEFLATE_CHUNK)
+        for (int y = 0; y < row_count; y++) {
+            const unsigned char *up = y > 0 ? packed + (size_t)(y - 1) * stream->row_bytes : stream->previous_row;
+            png_filter_row(packed + (size_t)y * stream->row_bytes, up, stream->row_bytes, stream->filtered + y * filtered_row);
+        }
+        memcpy(stream->previous_row, packed + (size_t)(row_count - 1) * stream->row_bytes, stream->row_bytes);
+    }
+
+    #pragma omp parallel for num_threads(parallel_thread_count()) schedule(dynamic, 1) if(chunk_count > 1)
+    for (int chunk = 0; chunk < chunk_count; chunk++) {
+        size_t start = (size_t)chunk * PNG_DEFLATE_CHUNK;
+        size_t length = size - start < PNG_DEFLATE_CHUNK ? size - start : PNG_DEFLATE_CHUNK;
+        unsigned char *slot = stream->compressed + chunk * slot_size;
+        memcpy(slot, "IDAT", 4);
+
+        z_stream zstream = {0};
+        if (deflateInit2(&zstream, png_compression_level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            continue;
+        }
+        if (chunk > 0) {
+            deflateSetDictionary(&zstream, stream->filtered + start - PNG_DEFLATE_WINDOW, PNG_DEFLATE_WINDOW);
+        } else if (stream->history_size > 0) {
+            deflateSetDictionary(&zstream, stream->history, (uInt)stream->history_size);
+        }
+        zstream.next_in = stream->filtered + start;
+        zstream.avail_in = (uInt)length;
+        zstream.next_out = slot + 4;
+        zstream.avail_out = (uInt)(slot_size - 4);
+        if (deflate(&zstream, Z_SYNC_FLUSH) == Z_OK && zstream.avail_in == 0) {
+            chunk_sizes[chunk] = slot_size - 4 - zstream.avail_out;
+        }
+        deflateEnd(&zstream);
+    }
+
+    for (int chunk = 0; chunk < chunk_count; chunk++) {
+        if (chunk_sizes[chunk] == 0) {
+            stream->failed = true;
+            break;
+        }
+        png_write_chunk(stream, stream->compressed + chunk * slot_size, 4 + chunk_sizes[chunk]);
+    }
+    free(chunk_sizes);
+    stream->adler = adler32(stream->adler, stream->filtered, (uInt)size);
+
+    // Keep the last 32 KB of filtered data to prime the next band's first chunk
+    if (size >= PNG_DEFLATE_WINDOW) {
+        memcpy(stream->history, stream->filtered + size - PNG_DEFLATE_WINDOW, PNG_DEFLATE_WINDOW);
+        stream->history_size = PNG_DEFLATE_WINDOW;
+    } else {
+        size_t keep = stream->history_size < PNG_DEFLATE_WINDOW - size ? stream->history_size : PNG_DEFLATE_WINDOW - size;
+        memmove(stream->history, stream->history + stream->history_size - keep, keep);
+        memcpy(stream->history + keep, stream->filtered, size);
+        stream->history_size = keep + size;
+    }
+}
+
+static int png_close(ImageStream *stream) {
+    // An empty final block ends the deflate stream, then the Adler-32 of everything filtered
+    unsigned char end[10] = {'I', 'D', 'A', 'T', 0x03, 0x00};
+    put_u32_be(end + 6, (uint32_t)stream->adler);
+    png_write_chunk(stream, end, sizeof(end));
+    unsigned char iend[4] = {'I', 'E', 'N', 'D'};
+    png_write_chunk(stream, iend, sizeof(iend));
+    free(stream->previous_row);
+    free(stream->filtered);
+    free(stream->compressed);
+    return 0;
+}
+
+static int ppm_open(ImageStream *stream) {
+    fprintf(stream->file, "P6\n%d %d\n255\n", stream->width, stream->height);
+    return 0;
+}
+
+static void ppm_write_rows(ImageStream *stream, const unsigned char *rows, int row_count) {
+    const unsigned char *packed = pack_rgb_rows(stream, rows, row_count);
+    if (packed && fwrite(packed, stream->row_bytes, row_count, stream->file) != (size_t)row_count) {
+        stream->failed = true;
+    }
+}
+
+// 24-bit BMP stored top-down (negative height), rows padded to 4 bytes
+static size_t bmp_row_bytes(const ImageStream *stream) {
+    return (stream->row_bytes + 3) & ~(size_t)3;
+}
+
+static int bmp_open(ImageStream *stream) {
+    uint64_t image_size = (uint64_t)bmp_row_bytes(stream) * stream->height;
+    if (image_size + 54 > UINT32_MAX) {
+        fprintf(stderr, "Error: Image is too large for BMP.\n");
+        return -1;
+    }
+    unsigned char header[54] = {'B', 'M'};
+    put_u32_le(header + 2, (uint32_t)(image_size + 54));
+    put_u32_le(header + 10, 54);  // Pixel data offset
+    put_u32_le(header + 14, 40);  // Info header size
+    put_u32_le(header + 18, (uint32_t)stream->width);
+    put_u32_le(header + 22, (uint32_t)-stream->height);
+    header[26] = 1;   // Planes
+    header[28] = 24;  // Bits per pixel
+    put_u32_le(header + 34, (uint32_t)image_size);
+    fwrite(header, 1, sizeof(header), stream->file);
+    return 0;
+}
+
+static void bmp_write_rows(ImageStream *stream, const unsigned char *rows, int row_count) {
+    size_t padded = bmp_row_bytes(stream);
+    unsigned char *row = image_stream_buffer(stream, &stream->scratch, &stream->scratch_size, padded);
+    if (!row) {
+        return;
+    }
+    memset(row, 0, padded);
+    for (int y = 0; y < row_count; y++) {
+        const unsigned char *in = rows + (size_t)y * stream->width * 4;
+        for (int x = 0; x < stream->width; x++) {
+            row[x * 3] = in[x * 4 + 2];
+            row[x * 3 + 1] = in[x * 4 + 1];
+            row[x * 3 + 2] = in[x * 4];
+        }
+        if (fwrite(row, 1, padded, stream->file) != padded) {
+            stream->failed = true;
+            return;
+        }
+    }
+}
+
+static int qoi_open(ImageStream *stream) {
+    unsigned char header[14] = {'q', 'o', 'i', 'f'};
+    put_u32_be(header + 4, (uint32_t)stream->width);
+    put_u32_be(header + 8, (uint32_t)stream->height);
+    header[12] = 3;  // RGB
+    header[13] = 0;  // sRGB
+    fwrite(header, 1, sizeof(header), stream->file);
+    return 0;
+}
+
+// QOI ops as in the reference encoder; alpha is always 255, so no RGBA ops are needed
+static void qoi_write_rows(ImageStream *stream, const unsigned char *rows, int row_count) {
+    size_t pixel_count = (size_t)stream->width * row_count;
+    // At most 4 bytes per pixel, plus a pending run
+    unsigned char *out = image_stream_buffer(stream, &stream->scratch, &stream->scratch_size, pixel_count * 4 + 1);
+    if (!out) {
+        return;
+    }
+    size_t length = 0;
+    unsigned char *previous = stream->qoi_previous;
+    for (size_t i = 0; i < pixel_count; i++) {
+        const unsigned char *px = rows + i * 4;
+        if (px[0] == previous[0] && px[1] == previous[1] && px[2] == previous[2]) {
+            if (++stream->qoi_run == 62) {
+                out[length++] = 0xc0 | (stream->qoi_run - 1);
+                stream->qoi_run = 0;
+            }
+            continue;
+        }
+        if (stream->qoi_run > 0) {
+            out[length++] = 0xc0 | (stream->qoi_run - 1);
+            stream->qoi_run = 0;
+        }
+
+        int index = (px[0] * 3 + px[1] * 5 + px[2] * 7 + 255 * 11) % 64;
+        unsigned char *slot = stream->qoi_index[index];
+        if (slot[0] == px[0] && slot[1] == px[1] && slot[2] == px[2] && slot[3] == 255) {
+            out[length++] = index;
+        } else {
+            memcpy(slot, px, 3);
+            slot[3] = 255;
+            signed char dr = px[0] - previous[0], dg = px[1] - previous[1], db = px[2] - previous[2];
+            signed char dr_dg = dr - dg, db_dg = db - dg;
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                out[length++] = 0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+            } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+                out[length++] = 0x80 | (dg + 32);
+                out[length++] = (dr_dg + 8) << 4 | (db_dg + 8);
+            } else {
+                out[length++] = 0xfe;
+                memcpy(out + length, px, 3);
+                length += 3;
+            }
+        }
+        memcpy(previous, px, 3);
+    }
+    if (fwrite(out, 1, length, stream->file) != length) {
+        stream->failed = true;
+    }
+}
+
+static int qoi_close(ImageStream *stream) {
+    if (stream->qoi_run > 0) {
+        fputc(0xc0 | (stream->qoi_run - 1), stream->file);
+    }
+    static const unsigned char end[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+    fwrite(end, 1, sizeof(end), stream->file);
+    return 0;
+}
+
+static int jpeg_open(ImageStream *stream) {
+    if (stream->width > 65535 || stream->height > 65535) {
+        fprintf(stderr, "Error: JPEG output is limited to 65535 pixels per side.\n");
+        return -1;
+    }
+    stream->canvas = malloc(stream->row_bytes * stream->height);
+    return stream->canvas ? 0 : -1;
+}
+
+static void jpeg_write_rows(ImageStream *stream, const unsigned char *rows, int row_count) {
+    const unsigned char *packed = pack_rgb_rows(stream, rows, row_count);
+    if (packed) {
+        memcpy(stream->canvas + stream->row_bytes * stream->rows_written, packed, stream->row_bytes * row_count);
+        stream->rows_written += row_count;
+    }
+}
+
+static void jpeg_write_file(void *context, void *data, int size) {
+    ImageStream *stream = context;
+    if (fwrite(data, 1, size, stream->file) != (size_t)size) {
+        stream->failed = true;
+    }
+}
+
+static int jpeg_close(ImageStream *stream) {
+    int written = stbi_write_jpg_to_func(jpeg_write_file, stream, stream->width, stream->height, 3, stream->canvas,
+                                         jpeg_quality);
+    free(stream->canvas);
+    return written ? 0 : -1;
+}
+
+// Indexed by OutputFormat
+typedef struct {
+    const char *name;  // --format value and file extension
+    int (*open)(ImageStream *stream);
+    void (*write_rows)(ImageStream *stream, const unsigned char *rows, int row_count);
+    int (*close)(ImageStream *stream);  // NULL when there is nothing to finish
+} ImageEncoder;
+
+static const ImageEncoder image_encoders[] = {
+    {"png", png_open, png_write_rows, png_close},
+    {"ppm", ppm_open, ppm_write_rows, NULL},
+    {"bmp", bmp_open, bmp_write_rows, NULL},
+    {"qoi", qoi_open, qoi_write_rows, qoi_close},
+    {"jpg", jpeg_open, jpeg_write_rows, jpeg_close},
+};
+
+// palette, if not NULL, holds every colour the image will contain; PNG then writes indexed colour
+int image_stream_open(ImageStream *stream, const char *path, OutputFormat format, int width, int height, const Palette *palette) {
+    memset(stream, 0, sizeof(*stream));
+    stream->format = format;
+    stream->palette = palette;
+    stream->width = width;
+    stream->height = height;
+    stream->row_bytes = (size_t)width * 3;
+    stream->file = fopen(path, "wb");
+    if (!stream->file) {
+        return -1;
+    }
+    if (image_encoders[format].open(stream) != 0) {
+        fclose(stream->file);
+        free(stream->scratch);
+        return -1;
+    }
+    return 0;
+}
+
+// Append row_count RGBA rows
+void image_stream_write_rows(ImageStream *stream, const unsigned char *rows, int row_count) {
+    if (!stream->failed) {
+        image_encoders[stream->format].write_rows(stream, rows, row_count);
+    }
+}
+
+// Finish the file and release the stream. Returns -1 if anything failed.
+int image_stream_close(ImageStream *stream) {
+    const ImageEncoder *encoder = &image_encoders[stream->format];
+    if (encoder->close && encoder->close(stream) != 0) {
+        stream->failed = true;
+    }
+    if (fclose(stream->file) != 0) {
+        stream->failed = true;
+    }
+    free(stream->scratch);
+    return stream->failed ? -1 : 0;
+}
+
+// Function to render ASCII art to an image file (output_format) with scaling, black background, and colored ASCII
+// characters.
+// Pixels come from the decoded RGB when it was kept (rgb), otherwise from the cache and its summed-area table.
+// Returns -1 if nothing was saved.
+int render_ascii_art_file_scaled(const uint8_t *rgb, const CachedPixel *cached_img, const SummedAreaTable *table, int img_width, int img_height, const char *char_set, int char_set_size, const char *output_file, float scale_factor, int font_scale) {
+    // Ensure there are pixels to render
+    if (!rgb && !cached_img) {
+        printf("Error: Cached image is NULL.\n");
+        return -1;
+    }
+
+    // Precompute scaled dimensions once and reuse in loops
+    double exact_width = (double)img_width * scale_factor, exact_height = (double)img_height * scale_factor;
+    if (exact_width < 1 || exact_height < 1 || exact_width > OUTPUT_MAX_DIMENSION || exact_height > OUTPUT_MAX_DIMENSION) {
+        printf("Error: Scaled output of %.0fx%.0f is outside 1-%d pixels per side.\n", exact_width, exact_height,
+               OUTPUT_MAX_DIMENSION);
+        return -1;
+    }
+    int scaled_width = (int)exact_width;
+    int scaled_height = (int)exact_height;
+
+    // One character cell every font_scale output pixels, covering font_scale / scale_factor source pixels;
+    // cells that would start past the edge of the source image are left out
+    int grid_width = 0, grid_height = 0;
+    while (grid_width * font_scale < scaled_width && (int)(grid_width * font_scale / scale_factor) < img_width) {
+        grid_width++;
+    }
+    while (grid_height * font_scale < scaled_height && (int)(grid_height * font_scale / scale_factor) < img_height) {
+        grid_height++;
+    }
+
+    int *col_edges = malloc(((size_t)grid_width + grid_height + 2) * sizeof(int));
+    CachedPixel *grid = malloc(((size_t)grid_width * grid_height + 1) * sizeof(CachedPixel));
+    if (!col_edges || !grid) {
+        printf("Failed to allocate memory for output image.\n");
+        free(col_edges);
+        free(grid);
+        return -1;
+    }
+
+    int *row_edges = col_edges + grid_width + 1;
+    for (int x = 0; x <= grid_width; x++) {
+        int edge = (int)(x * font_scale / scale_factor);
+        col_edges[x] = edge < img_width ? edge : img_width;
+    }
+    for (int y = 0; y <= grid_height; y++) {
+        int edge = (int)(y * font_scale / scale_factor);
+        row_edges[y] = edge < img_height ? edge : img_height;
+    }
+    CellGrid cells = {0};
+    if (sample_still_cells(rgb, cached_img, table, img_width, col_edges, row_edges, grid, grid_width, grid_height) != 0 ||
+        cell_grid_from_pixels(&cells, grid, grid_width, grid_height, char_set, char_set_size) != 0) {
+        printf("Failed to allocate memory for output image.\n");
+        free(col_edges);
+        free(grid);
+        return -1;
+    }
+    free(col_edges);
+    free(grid);
+
+    // The canvas is drawn and encoded a band of whole cell rows at a time, so memory stays at one band however
+    // large the output is
+    size_t row_bytes = (size_t)scaled_width * 4;
+    int band_cell_rows = (int)(RASTER_BAND_BYTES / (row_bytes * font_scale));
+    if (band_cell_rows < 1) {
+        band_cell_rows = 1;
+    }
+    int band_height = band_cell_rows * font_scale < scaled_height ? band_cell_rows * font_scale : scaled_height;
+
+    GlyphAtlas atlas;
+    unsigned char *band_img = malloc(row_bytes * band_height);
+    if (!band_img || build_glyph_atlas(&atlas, char_set, char_set_size, FONT_SIZE) != 0) {
+        printf("Failed to allocate memory for output image.\n");
+        free(band_img);
+        cell_grid_free(&cells);
+        return -1;
+    }
+
+    // Save the output image in the chosen format, timing the drawing and the encoding separately
+    // PNGs whose colours fit a palette are written indexed
+    Palette palette;
+    bool indexed = output_format == OUTPUT_PNG && cell_grid_palette(&cells, &atlas, font_scale, &palette);
+    ImageStream image;
+    int status = image_stream_open(&image, output_file, output_format, scaled_width, scaled_height,
+                                   indexed ? &palette : NULL);
+    if (status != 0) {
+        printf("Failed to create output file: %s\n", output_file);
+    } else {
+        mark_first_output();
+        double raster_time = 0.0, encode_time = 0.0;
+        struct timespec start, middle, end;
+        for (int top = 0; top < scaled_height; top += band_height) {
+            int bottom = top + band_height < scaled_height ? top + band_height : scaled_height;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            draw_cell_grid_rows(&cells, &atlas, band_img, scaled_width, font_scale, top, bottom);
+            clock_gettime(CLOCK_MONOTONIC, &middle);
+            image_stream_write_rows(&image, band_img, bottom - top);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            raster_time += (middle.tv_sec - start.tv_sec) + (middle.tv_nsec - start.tv_nsec) / 1e9;
+            encode_time += (end.tv_sec - middle.tv_sec) + (end.tv_nsec - middle.tv_nsec) / 1e9;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        status = image_stream_close(&image);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        encode_time += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        if (status != 0) {
+            printf("Failed to write output file: %s\n", output_file);
+        }
+        printf("Rasterization time: %.2f seconds\n", raster_time);
+        printf("Encode time (%s): %.2f seconds\n", image_encoders[output_format].name, encode_time);
+    }
+
+    free_glyph_atlas(&atlas);
+    free(band_img);
+    cell_grid_free(&cells);
+    return status;
+}
+
+// Pixels come from the decoded RGB when it was kept (rgb), otherwise from the cache and its summed-area table
+void render_ascii_art_file_txt(const uint8_t *rgb, const CachedPixel *cached_img, const SummedAreaTable *table, int img_width, int img_height, const char *char_set, int char_set_size, const char *output_file, int term_rows, int term_cols) {
+    // Ensure there are pixels to render
+    if (!rgb && !cached_img) {
+        printf("Error: Cached image is NULL.\n");
+        return;
+    }
+
+    // Use the same grid as the terminal renderer (leaves room for the debug lines)
+    int target_width, target_height;
+    compute_render_grid_size(img_width, img_height, term_rows, term_cols, &target_width, &target_height);
+
+    int *col_edges = malloc(((size_t)target_width + target_height + 2) * sizeof(int));
+    CachedPixel *grid = malloc(((size_t)target_width * target_height + 1) * sizeof(CachedPixel));
+    if (!col_edges || !grid) {
+        printf("Failed to allocate memory for the character grid.\n");
+        free(col_edges);
+        free(grid);
+        return;
+    }
+    int *row_edges = col_edges + target_width + 1;
+    uniform_cell_edges(img_width, target_width, col_edges);
+    uniform_cell_edges(img_height, target_height, row_edges);
+    if (sample_still_cells(rgb, cached_img, table, img_width, col_edges, row_edges, grid, target_width, target_height) != 0) {
+        printf("Failed to allocate memory for the character grid.\n");
+        free(col_edges);
+        free(grid);
+        return;
+    }
+
+    CellGrid cells = {0};
+    if (cell_grid_from_pixels(&cells, grid, target_width, target_height, char_set, char_set_size) != 0) {
+        printf("Failed to allocate memory for the character grid.\n");
+        free(col_edges);
+        free(grid);
+        return;
+    }
+    free(col_edges);
+    free(grid);
+
+    // Open the output file for writing
+    FILE *file = fopen(output_file, "w");
+    if (!file) {
+        printf("Failed to create output file: %s\n", output_file);
+        cell_grid_free(&cells);
+        return;
+    }
+
+    mark_first_output();
+
+    // Write the ASCII art to the text file from the same cells the terminal renderer would print
+    write_cell_grid_txt(&cells, file);
+
+    fclose(file);
+    cell_grid_free(&cells);
+    printf("ASCII art saved to text file: %s\n", output_file);
+}
+
+// Allocate a pool slot on first use so decoding can start before the whole pool exists
+int ensure_pool_slot(int producer_id, int pool_index, int width, int height) {
+    if (!frame_pool[producer_id][pool_index]) {
+        frame_pool[producer_id][pool_index] = av_frame_alloc();
+        if (!frame_pool[producer_id][pool_index]) {
+            fprintf(stderr, "Failed to allocate frame for pool\n");
+            return -1;
+        }
+    }
+
+    if (!buffer_pool[producer_id][pool_index]) {
+        buffer_pool[producer_id][pool_index] = (uint8_t *)av_malloc(av_image_get_buffer_size(AV_PIX_FMT_RGB24, width, height, 32));
+        if (!buffer_pool[producer_id][pool_index]) {
+            fprintf(stderr, "Failed to allocate buffer for pool\n");
+            return -1;
+        }
+    }
+
+    if (!cached_image_pool[producer_id][pool_index]) {
+        cached_image_pool[producer_id][pool_index] = (CachedPixel *)malloc((size_t)width * height * sizeof(CachedPixel));
+        if (!cached_image_pool[producer_id][pool_index]) {
+            fprintf(stderr, "Failed to allocate cached image for pool\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Seek the demuxer and decoder to target_seconds, landing on the preceding keyframe. Returns a negative AVERROR
+// if the input cannot seek.
+int perform_seek(AVFormatContext *pFormatContext, AVCodecContext *pCodecContext, int video_stream_index, double target_seconds) {
+    AVStream *stream = pFormatContext->streams[video_stream_index];
+    int64_t start_time = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    if (target_seconds < 0) {
+        target_seconds = 0;
+    }
+    int64_t target_pts = start_time + (int64_t)(target_seconds / av_q2d(stream->time_base));
+
+    int ret;
+    const IndexKeyframe *keyframe = sidecar_index.is_loaded ? sidecar_index_find_keyframe(&sidecar_index, target_pts) : NULL;
+    if (keyframe && keyframe->pos >= 0 && (pFormatContext->iformat->flags & AVFMT_TS_DISCONT)) {
+        // Timestamp seeks in transport-style streams bisect the file; jump straight to the indexed byte offset
+        ret = av_seek_frame(pFormatContext, video_stream_index, keyframe->pos, AVSEEK_FLAG_BYTE);
+    } else if (keyframe) {
+        // Seeking to an exact keyframe timestamp lets the demuxer stop at the first candidate
+        ret = av_seek_frame(pFormatContext, video_stream_index, keyframe->pts, AVSEEK_FLAG_BACKWARD);
+    } else {
+        ret = av_seek_frame(pFormatContext, video_stream_index, target_pts, AVSEEK_FLAG_BACKWARD);
+    }
+
+    if (ret < 0) {
+        fprintf(stderr, "Error seeking: %s\n", av_err2str(ret));
+        return ret;
+    }
+
+    pthread_mutex_lock(&decoder_mutex);
+    avcodec_flush_buffers(pCodecContext);
+    pthread_mutex_unlock(&decoder_mutex);
+
+    // Anything already queued belongs to the old position
+    pthread_mutex_lock(&buffer_mutex);
+    playback_generation++;
+    pthread_cond_broadcast(&buffer_cond);
+    pthread_mutex_unlock(&buffer_mutex);
+    return 0;
+}
+
+// Publish the producer's back slot as the newest frame and take the old middle slot as the new back slot
+void live_publish() {
+    int previous = atomic_exchange(&live_middle_slot, live_back_slot | LIVE_SLOT_FRESH);
+    if (previous & LIVE_SLOT_FRESH) {
+        live_overwritten_count++;
+    }
+    live_back_slot = previous & ~LIVE_SLOT_FRESH;
+    live_published_count++;
+}
+
+// Take the newest published frame into the consumer's front slot; false if nothing new was published
+bool live_acquire() {
+    if (!(atomic_load(&live_middle_slot) & LIVE_SLOT_FRESH)) {
+        return false;
+    }
+    // Only the producer sets the fresh bit, so it is still set here
+    int previous = atomic_exchange(&live_middle_slot, live_front_slot);
+    live_front_slot = previous & ~LIVE_SLOT_FRESH;
+    return true;
+}
+
+// Decode-side frame skipping for the current playback speed
+void apply_speed_discard(AVFormatContext *pFormatContext, AVCodecContext *pCodecContext, int video_stream_index, double speed) {
+    // At 4x and above non-reference frames are dropped on purpose, trading smoothness for decode throughput:
+    // demuxers that flag disposable packets drop them, and the decoder skips the rest without decoding
+    enum AVDiscard discard = speed >= 4.0 ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+    pFormatContext->streams[video_stream_index]->discard = discard;
+    pCodecContext->skip_frame = discard;
+
+    // Deblocking is barely visible once downsampled to characters; skip it where it cannot drift into other frames
+    if (speed >= 2.0) {
+        pCodecContext->skip_loop_filter = AVDISCARD_NONREF;
+    } else {
+        pCodecContext->skip_loop_filter = AVDISCARD_DEFAULT;
+    }
+}
+
+// Source regions need byte-addressable planes; bitstream, hardware and paletted formats are converted whole
+bool pix_fmt_supports_region(const AVPixFmtDescriptor *desc) {
+    return desc && !(desc->flags & (AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL));
+}
+
+// Point the source planes at the top-left of the region so sws_scale never reads pixels outside it
+void offset_frame_planes(const AVFrame *frame, const AVPixFmtDescriptor *desc, const PixelRect *rect, const uint8_t *planes[4]) {
+    // Bytes per pixel in each plane, from the first component stored in it. In packed subsampled formats such as
+    // yuyv422 that is luma (2 bytes per pixel); the region's x is already aligned to whole chroma pairs.
+    int plane_step[4] = {0};
+    for (int c = 0; c < desc->nb_components; c++) {
+        if (!plane_step[desc->comp[c].plane]) {
+            plane_step[desc->comp[c].plane] = desc->comp[c].step;
+        }
+    }
+
+    for (int p = 0; p < 4; p++) {
+        if (!frame->data[p]) {
+            planes[p] = NULL;
+            continue;
+        }
+        // Planes 1 and 2 are the (possibly subsampled) chroma planes
+        int shift_x = (p == 1 || p == 2) ? desc->log2_chroma_w : 0;
+        int shift_y = (p == 1 || p == 2) ? desc->log2_chroma_h : 0;
+        planes[p] = frame->data[p] + (ptrdiff_t)(rect->y >> shift_y) * frame->linesize[p] + (ptrdiff_t)(rect->x >> shift_x) * plane_step[p];
+    }
+}
+
+void *frame_producer(void *args) {
+    ProducerArgs *prod_args = (ProducerArgs *)args;
+
+    AVFormatContext *pFormatContext = prod_args->pFormatContext;
+    AVCodecContext *pCodecContext = prod_args->pCodecContext;
+    int video_stream_index = prod_args->video_stream_index;
+
+    // Created from the first decoded frame, so a minimal probe does not need to know the pixel format up front
+    struct SwsContext *sws_ctx = NULL;
+
+    AVPacket *packet = av_packet_alloc();
+    if (!packet) {
+        print_timestamp("Failed to allocate packet");
+        sws_freeContext(sws_ctx);
+        pthread_exit(NULL);
+    }
+
+    AVFrame *frame = av_frame_alloc();
+    if (!frame) {
+        print_timestamp("Failed to allocate frame");
+        av_packet_free(&packet);
+        sws_freeContext(sws_ctx);
+        pthread_exit(NULL);
+    }
+
+    int pool_index = 0; // Index for using frames and buffers from the pool
+    int current_buffer = 0; // 0 for Buffer A, 1 for Buffer B
+
+    int producer_id = prod_args->producer_id;
+
+    // Granular profiling
+    struct timespec read_frame_start, read_frame_end;
+    struct timespec send_packet_start, send_packet_end;
+    struct timespec receive_frame_start, receive_frame_end;
+    struct timespec convert_frame_start, convert_frame_end;
+    struct timespec cache_start, cache_end;
+
+    double read_frame_total_time = 0.0;
+    double send_packet_total_time = 0.0;
+    double receive_frame_total_time = 0.0;
+    double convert_frame_total_time = 0.0;
+    double cache_total_time = 0.0;
+
+    // Region of interest: sws_scale reads only the source rectangle and scales it to fill the pool frame
+    const AVPixFmtDescriptor *pix_desc = NULL;
+    bool region_supported = false;
+    int applied_view_generation = -1;
+    int source_format = AV_PIX_FMT_NONE;
+    PixelRect source_rect = {0, 0, pCodecContext->width, pCodecContext->height};
+    int output_width = pCodecContext->width;
+    int output_height = pCodecContext->height;
+
+    // Live mode: read times of recent packets, matched to decoded frames by DTS for input-to-display latency
+    struct {
+        int64_t dts;
+        struct timespec read_time;
+    } packet_times[LIVE_PACKET_TIME_HISTORY];
+    int packet_time_index = 0;
+    memset(packet_times, 0, sizeof(packet_times));
+
+    // Frame skipping for fast playback
+    AVRational time_base = pFormatContext->streams[video_stream_index]->time_base;
+    double applied_speed = 0.0;
+    double next_wanted_seconds = -1e300;  // Earliest stream time worth converting
+    int skip_generation = playback_generation;
+    bool rewinding = false;  // The pending seek is the loop rewind requested at EOF
+
+    while (is_running && !terminated) {
+        if (playback_speed != applied_speed) {
+            applied_speed = playback_speed;
+            pthread_mutex_lock(&decoder_mutex);
+            apply_speed_discard(pFormatContext, pCodecContext, video_stream_index, applied_speed);
+            pthread_mutex_unlock(&decoder_mutex);
+        }
+
+        if (seek_requested) {
+            // The index no longer sees every packet in order once we jump around
+            index_recording = false;
+            int seek_status = perform_seek(pFormatContext, pCodecContext, video_stream_index, seek_target_seconds);
+            seek_requested = false;
+            // A rewind that fails would only reach EOF again; end playback, which also wakes the consumer
+            if (seek_status < 0 && rewinding) {
+                break;
+            }
+            rewinding = false;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &producer_start_time);  // Start profiling
+
+        clock_gettime(CLOCK_MONOTONIC, &read_frame_start);
+
+        int ret = av_read_frame(pFormatContext, packet);
+
+        clock_gettime(CLOCK_MONOTONIC, &read_frame_end);
+        read_frame_total_time += (read_frame_end.tv_sec - read_frame_start.tv_sec) + (read_frame_end.tv_nsec - read_frame_start.tv_nsec) / 1e9;
+
+        if (ret < 0) {
+            if (ret == AVERROR_EOF) {
+                // End of file reached, no more packets to read
+                if (index_recording) {
+                    index_pass_complete = true;
+                }
+
+                if (loop_playback) {
+                    // Wait for the consumer to either replay from its cache or ask for a rewind
+                    pthread_mutex_lock(&buffer_mutex);
+                    producer_at_eof = true;
+                    pthread_cond_broadcast(&buffer_cond);
+                    while (!seek_requested && !loop_cache_playing && !terminated) {
+                        pthread_cond_wait(&buffer_cond, &buffer_mutex);
+                    }
+                    pthread_mutex_unlock(&buffer_mutex);
+
+                    if (seek_requested) {
+                        rewinding = true;
+                        continue;
+                    }
+                }
+                break;
+            } else {
+                fprintf(stderr, "Error reading frame: %s\n", av_err2str(ret));
+            }
+            break; // Exit the loop if there's an error or EOF
+        }
+
+        if (packet->stream_index == video_stream_index) {
+            if (index_recording) {
+                sidecar_index_add_packet(&sidecar_index, packet);
+            }
+
+            if (live_mode) {
+                packet_times[packet_time_index].dts = packet->dts;
+                packet_times[packet_time_index].read_time = read_frame_end;
+                packet_time_index = (packet_time_index + 1) % LIVE_PACKET_TIME_HISTORY;
+            }
+
+            clock_gettime(CLOCK_MONOTONIC, &send_packet_start);
+
+            // Lock decoder access
+            pthread_mutex_lock(&decoder_mutex);
+            ret = avcodec_send_packet(pCodecContext, packet);
+
+            pthread_mutex_unlock(&decoder_mutex);
+
+            if (ret == AVERROR(EAGAIN)) {
+                usleep(10000); // Small sleep to allow buffer processing
+                continue;
+            }
+
+            clock_gettime(CLOCK_MONOTONIC, &send_packet_end);
+            send_packet_total_time += (send_packet_end.tv_sec - send_packet_start.tv_sec) +
+                                      (send_packet_end.tv_nsec - send_packet_start.tv_nsec) / 1e9;
+
+            if (ret < 0) {
+                fprintf(stderr, "Error sending packet to decoder: %s\n", av_err2str(ret));
+                av_packet_unref(packet);
+                continue;
+            }
+
+            // Lock decoder access to safely process the decoder output
+            pthread_mutex_lock(&decoder_mutex);
+            while ((ret = avcodec_receive_frame(pCodecContext, frame)) == 0) {
+                clock_gettime(CLOCK_MONOTONIC, &receive_frame_start);
+
+                // Faster than 1x, only one source frame per output frame interval is shown; skip the rest before converting
+                if (playback_generation != skip_generation) {
+                    skip_generation = playback_generation;
+                    next_wanted_seconds = -1e300;
+                }
+                if (applied_speed > 1.0 && frame->best_effort_timestamp != AV_NOPTS_VALUE) {
+                    double frame_seconds = frame->best_effort_timestamp * av_q2d(time_base);
+                    if (frame_seconds < next_wanted_seconds) {
+                        producer_skipped_frame_count++;
+                        continue;
+                    }
+                    next_wanted_seconds = frame_seconds + (applied_speed - 0.5) / prod_args->fps;
+                }
+
+                if (live_mode) {
+                    // Live mode writes into the triple buffer's back slot, which the consumer never touches
+                    pool_index = live_back_slot;
+                } else {
+                    // Both buffers map slot buffer_write_index onto the same pool entry, so wait until neither holds it
+                    // before the conversion below overwrites it
+                    pthread_mutex_lock(&buffer_mutex);
+                    while ((frame_buffer[current_buffer][buffer_write_index].is_ready ||
+                            frame_buffer[1 - current_buffer][buffer_write_index].is_ready) && !terminated) {
+                        pthread_cond_wait(&buffer_cond, &buffer_mutex);
+                    }
+                    pthread_mutex_unlock(&buffer_mutex);
+                }
+
+                if (ensure_pool_slot(producer_id, pool_index, pCodecContext->width, pCodecContext->height) != 0) {
+                    is_running = false;
+                    break;
+                }
+
+                // Use pooled RGB frame
+                AVFrame *rgb_frame = frame_pool[producer_id][pool_index];
+                uint8_t *buffer = buffer_pool[producer_id][pool_index];
+
+                // Convert the frame to RGB
+                clock_gettime(CLOCK_MONOTONIC, &convert_frame_start);
+
+                int current_view_generation;
+                ViewRegion view = get_view_region(&current_view_generation);
+                if (current_view_generation != applied_view_generation || !sws_ctx || frame->format != source_format) {
+                    applied_view_generation = current_view_generation;
+                    source_format = frame->format;
+                    pix_desc = av_pix_fmt_desc_get(frame->format);
+                    region_supported = pix_fmt_supports_region(pix_desc);
+
+                    source_rect = (PixelRect){0, 0, pCodecContext->width, pCodecContext->height};
+                    if (region_supported) {
+                        view_region_to_rect(&view, pCodecContext->width, pCodecContext->height,
+                                            pix_desc->log2_chroma_w, pix_desc->log2_chroma_h, &source_rect);
+                    }
+
+                    // Fit the region into the pool frame size, keeping the region's aspect ratio
+                    if ((int64_t)source_rect.width * pCodecContext->height >= (int64_t)source_rect.height * pCodecContext->width) {
+                        output_width = pCodecContext->width;
+                        output_height = (int)((int64_t)pCodecContext->width * source_rect.height / source_rect.width);
+                    } else {
+                        output_height = pCodecContext->height;
+                        output_width = (int)((int64_t)pCodecContext->height * source_rect.width / source_rect.height);
+                    }
+                    if (output_width < 1) output_width = 1;
+                    if (output_height < 1) output_height = 1;
+
+                    sws_ctx = sws_getCachedContext(sws_ctx, source_rect.width, source_rect.height, frame->format,
+                                                   output_width, output_height, AV_PIX_FMT_RGB24,
+                                                   SWS_FAST_BILINEAR, NULL, NULL, NULL);
+                    if (!sws_ctx) {
+                        print_timestamp("Failed to update the SWS context for the view region");
+                        is_running = false;
+                        break;
+                    }
+                }
+
+                const uint8_t *source_planes[4] = {frame->data[0], frame->data[1], frame->data[2], frame->data[3]};
+                if (region_supported) {
+                    offset_frame_planes(frame, pix_desc, &source_rect, source_planes);
+                }
+
+                // Tightly packed rows, as cache_grayscale_values expects
+                rgb_frame->pts = frame->best_effort_timestamp;
+                rgb_frame->width = output_width;
+                rgb_frame->height = output_height;
+                av_image_fill_arrays(rgb_frame->data, rgb_frame->linesize, buffer, AV_PIX_FMT_RGB24,
+                                     output_width, output_height, 1);
+                sws_scale(sws_ctx, source_planes, frame->linesize, 0, source_rect.height,
+                          rgb_frame->data, rgb_frame->linesize);
+
+                clock_gettime(CLOCK_MONOTONIC, &convert_frame_end);
+                convert_frame_total_time += (convert_frame_end.tv_sec - convert_frame_start.tv_sec) +
+                                            (convert_frame_end.tv_nsec - convert_frame_start.tv_nsec) / 1e9;
+
+                // Reduce the RGB frame straight to the character grid for the current terminal size with the fused
+                // kernel; the consumer resamples if the terminal is resized before the frame is shown. A grid with
+                // more cells than the frame has pixels (tiny videos) keeps the whole frame instead.
+                int term_rows, term_cols, grid_width, grid_height;
+                get_terminal_size(&term_rows, &term_cols);
+                compute_render_grid_size(output_width, output_height, term_rows, term_cols, &grid_width, &grid_height);
+                if (grid_width <= 0 || grid_height <= 0 || (int64_t)grid_width * grid_height > (int64_t)output_width * output_height) {
+                    grid_width = grid_height = 0;
+                }
+
+                if (live_mode) {
+                    // Cache the grid and publish as the newest frame, replacing any the consumer has not taken
+                    clock_gettime(CLOCK_MONOTONIC, &cache_start);
+                    cache_frame_cells(rgb_frame, cached_image_pool[producer_id][pool_index], &grid_width, &grid_height);
+                    live_grid_width[pool_index] = grid_width;
+                    live_grid_height[pool_index] = grid_height;
+                    clock_gettime(CLOCK_MONOTONIC, &cache_end);
+                    cache_total_time +=
+                            (cache_end.tv_sec - cache_start.tv_sec) + (cache_end.tv_nsec - cache_start.tv_nsec) / 1e9;
+
+                    live_input_time[pool_index] = packet_times[(packet_time_index + LIVE_PACKET_TIME_HISTORY - 1) % LIVE_PACKET_TIME_HISTORY].read_time;
+                    for (int i = 0; i < LIVE_PACKET_TIME_HISTORY; i++) {
+                        if (packet_times[i].dts == frame->pkt_dts) {
+                            live_input_time[pool_index] = packet_times[i].read_time;
+                            break;
+                        }
+                    }
+                    live_publish();
+
+                    clock_gettime(CLOCK_MONOTONIC, &receive_frame_end);
+                    receive_frame_total_time += (receive_frame_end.tv_sec - receive_frame_start.tv_sec) +
+                                                (receive_frame_end.tv_nsec - receive_frame_start.tv_nsec) / 1e9;
+                    continue;
+                }
+
+                // Lock the buffer and write frame to it
+                pthread_mutex_lock(&buffer_mutex);
+
+                // Cache the character grid
+                clock_gettime(CLOCK_MONOTONIC, &cache_start);
+
+                frame_buffer[current_buffer][buffer_write_index].cached_img = cached_image_pool[producer_id][pool_index];
+                cache_frame_cells(rgb_frame, frame_buffer[current_buffer][buffer_write_index].cached_img, &grid_width, &grid_height);
+                frame_buffer[current_buffer][buffer_write_index].grid_width = grid_width;
+                frame_buffer[current_buffer][buffer_write_index].grid_height = grid_height;
+
+                clock_gettime(CLOCK_MONOTONIC, &cache_end);
+                cache_total_time +=
+                        (cache_end.tv_sec - cache_start.tv_sec) + (cache_end.tv_nsec - cache_start.tv_nsec) / 1e9;
+
+                frame_buffer[current_buffer][buffer_write_index].frame = frame_pool[producer_id][pool_index];
+                frame_buffer[current_buffer][buffer_write_index].generation = playback_generation;
+                frame_buffer[current_buffer][buffer_write_index].is_ready = 1;
+
+                buffer_write_index = (buffer_write_index + 1) % BUFFER_POOL_SIZE;
+
+                // Switch the buffer after filling all slots
+                if (buffer_write_index == 0) {
+                    current_buffer = 1 - current_buffer;
+                }
+
+                pthread_cond_signal(&buffer_cond);
+                pthread_mutex_unlock(&buffer_mutex);
+
+                pool_index = (pool_index + 1) % BUFFER_POOL_SIZE;
+
+                clock_gettime(CLOCK_MONOTONIC, &receive_frame_end);
+                receive_frame_total_time += (receive_frame_end.tv_sec - receive_frame_start.tv_sec) +
+                                            (receive_frame_end.tv_nsec - receive_frame_start.tv_nsec) / 1e9;
+
+            }
+            pthread_mutex_unlock(&decoder_mutex);
+            // ret is still 0 when the loop stopped on a pool or scaler failure, which was reported where it happened
+            if (ret < 0 && ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
+                fprintf(stderr, "Error receiving frame from decoder: %s\n", av_err2str(ret));
+            }
+        }
+        av_packet_unref(packet);
+
+        clock_gettime(CLOCK_MONOTONIC, &producer_end_time);  // End profiling
+        producer_total_time += (producer_end_time.tv_sec - producer_start_time.tv_sec) + (producer_end_time.tv_nsec - producer_start_time.tv_nsec) / 1e9;
+        producer_frame_count++;
+    }
+
+    pthread_mutex_lock(&buffer_mutex);
+    is_done = true; // Set the flag to indicate producer is done
+    pthread_cond_broadcast(&buffer_cond); // Notify all waiting consumers
+    pthread_mutex_unlock(&buffer_mutex);
+
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    sws_freeContext(sws_ctx);
+
+    // Store granular profiling results
+    producer_read_frame_total_time = read_frame_total_time;
+    producer_send_packet_total_time = send_packet_total_time;
+    producer_receive_frame_total_time = receive_frame_total_time;
+    producer_convert_frame_total_time = convert_frame_total_time;
     producer_cache_total_time = cache_total_time;
 
-    pthread_exit(NULL);
+    pthread_exit(NULL);
+}
+
+// Sleep until an absolute CLOCK_MONOTONIC deadline (nanosleep, since clock_nanosleep is not available everywhere)
+void sleep_until(const struct timespec *deadline) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double remaining = (deadline->tv_sec - now.tv_sec) + (deadline->tv_nsec - now.tv_nsec) / 1e9;
+    if (remaining > 0) {
+        struct timespec duration = {(time_t)remaining, (long)((remaining - (time_t)remaining) * 1e9)};
+        nanosleep(&duration, NULL);
+    }
+}
+
+void add_seconds(struct timespec *time, double seconds) {
+    long long nanoseconds = time->tv_nsec + (long long)(seconds * 1e9);
+    time->tv_sec += nanoseconds / 1000000000LL;
+    time->tv_nsec = nanoseconds % 1000000000LL;
+}
+
+// Quit playback from the consumer side: restore the cursor and report profiling before exiting
+void quit_playback() {
+    terminated = true;
+    // Show cursor after finishing video
+    printf("\033[?25h");
+    fflush(stdout);
+
+    print_profiling_results();
+    exit(0);
+}
+
+// Poll stdin for up to timeout_us; returns the number of key bytes read (an escape sequence arrives as one read)
+ssize_t poll_keys(char *keys, size_t size, int timeout_us) {
+    fd_set readfds;
+    struct timeval timeout;
+
+    FD_ZERO(&readfds);
+    FD_SET(STDIN_FILENO, &readfds);
+    timeout.tv_sec = 0;
+    timeout.tv_usec = timeout_us;
+
+    if (select(STDIN_FILENO + 1, &readfds, NULL, NULL, &timeout) > 0) {
+        return read(STDIN_FILENO, keys, size);
+    }
+    return 0;
+}
+
+// Keep a sampled render grid for replay; gives up on the cache once it exceeds the budget
+void loop_cache_append(CachedPixel *cells, int width, int height, int img_width, int img_height, int64_t pts, double duration) {
+    size_t frame_bytes = (size_t)width * height * sizeof(CachedPixel);
+    if (loop_cache_bytes + frame_bytes > loop_cache_budget) {
+        loop_cache_valid = false;
+        free(cells);
+        return;
+    }
+
+    if (loop_cache_count == loop_cache_capacity) {
+        int new_capacity = loop_cache_capacity ? loop_cache_capacity * 2 : 256;
+        LoopCacheFrame *frames = realloc(loop_cache_frames, new_capacity * sizeof(LoopCacheFrame));
+        if (!frames) {
+            loop_cache_valid = false;
+            free(cells);
+            return;
+        }
+        loop_cache_frames = frames;
+        loop_cache_capacity = new_capacity;
+    }
+
+    loop_cache_frames[loop_cache_count++] = (LoopCacheFrame){cells, width, height, img_width, img_height, pts, duration};
+    loop_cache_bytes += frame_bytes;
+}
+
+void loop_cache_free() {
+    for (int i = 0; i < loop_cache_count; i++) {
+        free(loop_cache_frames[i].cells);
+    }
+    free(loop_cache_frames);
+    loop_cache_frames = NULL;
+    loop_cache_count = loop_cache_capacity = 0;
+    loop_cache_bytes = 0;
+}
+
+// Replay the cached render grids forever, each for its own duration; no demuxing or decoding happens here
+void play_loop_cache(int term_rows, int term_cols, const char *char_set, int char_set_size) {
+    struct timespec next_frame_time;
+    clock_gettime(CLOCK_MONOTONIC, &next_frame_time);
+
+    while (!terminated) {
+        for (int i = 0; i < loop_cache_count && !terminated; i++) {
+            LoopCacheFrame *cached = &loop_cache_frames[i];
+
+            if (resized) {
+                get_terminal_size(&term_rows, &term_cols);
+                clear_terminal();  // Only clear on resize
+                resized = false;
+            }
+
+            int target_width, target_height;
+            compute_render_grid_size(cached->img_width, cached->img_height, term_rows, term_cols, &target_width, &target_height);
+            if (target_width == cached->width && target_height == cached->height) {
+                render_ascii_grid_terminal(cached->cells, cached->width, cached->height,
+                                           cached->img_width, cached->img_height, term_rows, term_cols,
+                                           char_set, char_set_size, NULL);
+            } else {
+                // The terminal changed size since the first pass; resample the cached grid instead of decoding again
+                render_ascii_art_terminal(cached->cells, cached->width, cached->height, term_rows, term_cols,
+                                          char_set, char_set_size, NULL);
+            }
+            loop_replayed_frame_count++;
+
+            char keys[3];
+            ssize_t key_count = poll_keys(keys, sizeof(keys), 5000);
+            if (key_count > 0 && keys[0] == 'q') {
+                quit_playback();
+            } else if (key_count > 0 && (keys[0] == '+' || keys[0] == '=' || keys[0] == '-')) {
+                change_playback_speed(keys[0] == '-' ? -1 : 1);
+            }
+
+            add_seconds(&next_frame_time, cached->duration / playback_speed);
+            sleep_until(&next_frame_time);
+        }
+    }
+}
+
+// Mark the frame at the read index as consumed and advance; buffer_mutex must be held
+void release_frame_slot(int *current_buffer) {
+    frame_buffer[*current_buffer][buffer_read_index].is_ready = 0;
+    buffer_read_index = (buffer_read_index + 1) % BUFFER_POOL_SIZE;
+    frames_released++;
+
+    // Switch buffer after consuming all slots
+    if (buffer_read_index == 0) {
+        *current_buffer = 1 - *current_buffer;
+    }
+
+    // Image sequences have several workers waiting on different slots
+    pthread_cond_broadcast(&buffer_cond);
+}
+
+// Consumer thread function: Renders frames to terminal
+void *frame_consumer(void *args) {
+    ConsumerArgs *cons_args = (ConsumerArgs *)args;
+    int last_frame_width = cons_args->pCodecContext_width;
+    int last_frame_height = cons_args->pCodecContext_height;
+    double position_seconds = 0.0;  // Timestamp of the last rendered frame, used as the base for seeking
+
+    // Presentation clock state
+    bool clock_started = false;
+    struct timespec clock_origin_time;
+    double clock_origin_position = 0.0;
+    int clock_generation = 0;
+    double clock_speed = 1.0;
+
+    struct timespec previous_time, current_time;
+    double total_elapsed_time = 0.0;
+    int frame_count = 0;
+    const int fps_calculation_window = 10;  // Calculate FPS every 10 frames
+
+    // Profiling variables for different consumer stages
+    double lock_wait_total = 0.0;
+    double render_total = 0.0;
+    double buffer_update_total = 0.0;
+
+    // Start time for FPS calculation
+    clock_gettime(CLOCK_MONOTONIC, &previous_time);
+
+    int current_buffer = 0; // 0 for Buffer A, 1 for Buffer B
+
+    int term_rows, term_cols;
+    get_terminal_size(&term_rows, &term_cols);
+    clear_terminal();
+
+    set_nonblocking_input();  // Set terminal input to non-blocking
+
+    while (is_running && !terminated) {
+        struct timespec stage_start, stage_end;
+
+        // Stage 1: Lock and wait for frame availability
+        clock_gettime(CLOCK_MONOTONIC, &stage_start);
+
+        pthread_mutex_lock(&buffer_mutex);
+
+        // Wait until there's a frame ready to consume or the producer signals completion
+        while (!frame_buffer[current_buffer][buffer_read_index].is_ready && !is_done && !producer_at_eof) {
+            pthread_cond_wait(&buffer_cond, &buffer_mutex);
+        }
+
+        // In loop mode the producer waits at EOF: replay from the cache if it holds the whole clip, else rewind
+        if (producer_at_eof && !frame_buffer[current_buffer][buffer_read_index].is_ready) {
+            producer_at_eof = false;
+            if (loop_cache_valid && loop_cache_count > 0) {
+                loop_cache_playing = true;
+                pthread_cond_broadcast(&buffer_cond);
+                pthread_mutex_unlock(&buffer_mutex);
+                play_loop_cache(term_rows, term_cols, ASCII_CHARS_DEFAULT, ascii_map_size_default);
+                break;
+            }
+
+            loop_cache_valid = false;
+            loop_cache_free();
+            seek_target_seconds = 0.0;
+            seek_requested = true;
+            pthread_cond_broadcast(&buffer_cond);
+            pthread_mutex_unlock(&buffer_mutex);
+            continue;
+        }
+
+        // If producer is done and there are no more frames left, exit the loop
+        if (is_done && !frame_buffer[current_buffer][buffer_read_index].is_ready) {
+            pthread_mutex_unlock(&buffer_mutex);
+            break;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &stage_end);
+        lock_wait_total += (stage_end.tv_sec - stage_start.tv_sec) + (stage_end.tv_nsec - stage_start.tv_nsec) / 1e9;
+
+        // Frames queued before a seek are released without rendering
+        if (frame_buffer[current_buffer][buffer_read_index].generation != playback_generation) {
+            release_frame_slot(&current_buffer);
+            pthread_mutex_unlock(&buffer_mutex);
+            continue;
+        }
+
+        // Presentation clock: stream time maps to wall time scaled by the playback speed,
+        // re-based whenever playback starts, seeks, loops or changes speed
+        int64_t frame_pts = frame_buffer[current_buffer][buffer_read_index].frame->pts;
+        if (frame_pts != AV_NOPTS_VALUE) {
+            double frame_position = (frame_pts - cons_args->start_time) * av_q2d(cons_args->time_base);
+            double speed = playback_speed;
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+
+            if (!clock_started || clock_generation != playback_generation || clock_speed != speed ||
+                frame_position < clock_origin_position) {
+                clock_origin_time = now;
+                clock_origin_position = frame_position;
+                clock_generation = playback_generation;
+                clock_speed = speed;
+                clock_started = true;
+            } else {
+                struct timespec present_time = clock_origin_time;
+                add_seconds(&present_time, (frame_position - clock_origin_position) / speed);
+                double lateness = (now.tv_sec - present_time.tv_sec) + (now.tv_nsec - present_time.tv_nsec) / 1e9;
+
+                if (lateness > 1.0 / cons_args->fps) {
+                    // More than a frame behind: drop it to catch up
+                    consumer_dropped_frame_count++;
+                    release_frame_slot(&current_buffer);
+                    pthread_mutex_unlock(&buffer_mutex);
+                    continue;
+                }
+
+                if (lateness < 0) {
+                    // Early: wait without holding the lock; the slot stays ours while is_ready is set
+                    pthread_mutex_unlock(&buffer_mutex);
+                    sleep_until(&present_time);
+                    pthread_mutex_lock(&buffer_mutex);
+
+                    if (frame_buffer[current_buffer][buffer_read_index].generation != playback_generation) {
+                        release_frame_slot(&current_buffer);
+                        pthread_mutex_unlock(&buffer_mutex);
+                        continue;
+                    }
+                }
+            }
+            position_seconds = frame_position;
+        }
+
+        // Stage 2: Render the frame
+        clock_gettime(CLOCK_MONOTONIC, &stage_start);
+
+        // Handle terminal resize if necessary
+        if (resized) {
+            get_terminal_size(&term_rows, &term_cols);
+            clear_terminal();  // Only clear on resize
+            resized = false;
+        }
+
+        // Consume the frame; its size follows the view region
+        CachedPixel *cached_img = frame_buffer[current_buffer][buffer_read_index].cached_img;
+        int frame_width = frame_buffer[current_buffer][buffer_read_index].frame->width;
+        int frame_height = frame_buffer[current_buffer][buffer_read_index].frame->height;
+        if (frame_width != last_frame_width || frame_height != last_frame_height) {
+            clear_terminal();  // The character grid may change shape with a new crop
+            last_frame_width = frame_width;
+            last_frame_height = frame_height;
+        }
+
+        DebugInfo debug_info = {0};
+
+        if (frame_count % fps_calculation_window == 0 && frame_count > 0) {
+            // Calculate FPS only if we have enough frames and avoid division by zero
+            double avg_fps = fps_calculation_window / (total_elapsed_time + 1e-9);  // Add a small epsilon to avoid zero
+            double avg_frame_delay = (total_elapsed_time / fps_calculation_window) * 1000.0;  // in milliseconds
+
+            debug_info.has_fps_info = true;
+            debug_info.avg_fps = avg_fps;
+            debug_info.avg_frame_delay = avg_frame_delay;
+
+            // Reset for the next calculation window
+            total_elapsed_time = 0.0;
+        }
+
+        // Render the frame to the terminal
+        const FrameBuffer *entry = &frame_buffer[current_buffer][buffer_read_index];
+        int grid_width, grid_height;
+        const CachedPixel *grid = frame_render_grid(cached_img, entry->grid_width ? entry->grid_width : frame_width,
+                                                    entry->grid_height ? entry->grid_height : frame_height,
+                                                    frame_width, frame_height, term_rows, term_cols, &grid_width, &grid_height);
+        if (grid) {
+            render_ascii_grid_terminal(grid, grid_width, grid_height, frame_width, frame_height,
+                                       term_rows, term_cols, ASCII_CHARS_DEFAULT, ascii_map_size_default, &debug_info);
+
+            // First pass of a loop: keep a copy of the grid that was printed
+            CachedPixel *loop_cells = loop_playback && loop_cache_valid ? malloc((size_t)grid_width * grid_height * sizeof(CachedPixel)) : NULL;
+            if (loop_cells) {
+                memcpy(loop_cells, grid, (size_t)grid_width * grid_height * sizeof(CachedPixel));
+                loop_cache_append(loop_cells, grid_width, grid_height, frame_width, frame_height, frame_pts, 1.0 / cons_args->fps);
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &stage_end);
+        render_total += (stage_end.tv_sec - stage_start.tv_sec) + (stage_end.tv_nsec - stage_start.tv_nsec) / 1e9;
+
+        // Stage 3: Update buffer indices
+        clock_gettime(CLOCK_MONOTONIC, &stage_start);
+
+        // Mark frame as consumed and update the read index
+        release_frame_slot(&current_buffer);
+        pthread_mutex_unlock(&buffer_mutex);
+
+        clock_gettime(CLOCK_MONOTONIC, &stage_end);
+        buffer_update_total += (stage_end.tv_sec - stage_start.tv_sec) + (stage_end.tv_nsec - stage_start.tv_nsec) / 1e9;
+
+        // End time for FPS calculation
+        clock_gettime(CLOCK_MONOTONIC, &current_time);
+        double frame_elapsed_time =
+                (current_time.tv_sec - previous_time.tv_sec) + (current_time.tv_nsec - previous_time.tv_nsec) / 1e9;
+
+        // Only accumulate frame_elapsed_time if it's greater than zero to avoid division issues
+        if (frame_elapsed_time > 0) {
+            total_elapsed_time += frame_elapsed_time;
+            frame_count++;
+        }
+
+        previous_time = current_time;
+
+        // Profiling
+        consumer_frame_count++;
+
+        // Check if 'q' has been pressed to quit, or an arrow key to seek
+        char keys[3];
+        ssize_t key_count = poll_keys(keys, sizeof(keys), 5000);
+        if (key_count > 0 && keys[0] == 'q') {
+            quit_playback();
+        } else if (key_count > 0 && (keys[0] == '+' || keys[0] == '=' || keys[0] == '-')) {
+            change_playback_speed(keys[0] == '-' ? -1 : 1);
+        } else if (key_count > 0 && handle_view_key(keys[0])) {
+            // Zoom/pan applies from the next converted frame; the loop cache holds the old view
+            loop_cache_valid = false;
+        } else if (cons_args->seekable && key_count == 3 && keys[0] == '\033' && keys[1] == '[' && (keys[2] == 'C' || keys[2] == 'D')) {
+            // Right/left arrow: seek forward/back; the loop cache no longer holds the clip in order
+            seek_target_seconds = position_seconds + (keys[2] == 'C' ? SEEK_STEP_SECONDS : -SEEK_STEP_SECONDS);
+            seek_requested = true;
+            loop_cache_valid = false;
+        }
+    }
+
+    // Update global profiling variables for consumer stages
+    consumer_lock_wait_total += lock_wait_total;
+    consumer_render_total += render_total;
+    consumer_buffer_update_total += buffer_update_total;
+
+    pthread_exit(NULL);
+}
+
+// Live consumer: renders the newest published frame and skips any it was too slow to show, so latency never queues up
+void *live_frame_consumer(void *args) {
+    ConsumerArgs *cons_args = (ConsumerArgs *)args;
+    int last_frame_width = cons_args->pCodecContext_width;
+    int last_frame_height = cons_args->pCodecContext_height;
+
+    struct timespec previous_time;
+    double total_elapsed_time = 0.0;
+    int frame_count = 0;
+    const int fps_calculation_window = 10;  // Calculate FPS every 10 frames
+    double last_latency = -1.0;             // Latency of the last frame shown, once one has been
+
+    double lock_wait_total = 0.0;
+    double render_total = 0.0;
+
+    clock_gettime(CLOCK_MONOTONIC, &previous_time);
+
+    int term_rows, term_cols;
+    get_terminal_size(&term_rows, &term_cols);
+    clear_terminal();
+
+    set_nonblocking_input();  // Set terminal input to non-blocking
+
+    while (is_running && !terminated) {
+        struct timespec stage_start, stage_end;
+        char keys[3];
+        ssize_t key_count;
+
+        // Stage 1: Take the newest frame, or wait briefly on input while none is pending.
+        // is_done is read first so a frame published just before the producer finished is still shown.
+        clock_gettime(CLOCK_MONOTONIC, &stage_start);
+        bool producer_done = is_done;
+        bool have_frame = live_acquire();
+        if (!have_frame) {
+            if (producer_done) {
+                break;
+            }
+            key_count = poll_keys(keys, sizeof(keys), LIVE_IDLE_POLL_US);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &stage_end);
+        lock_wait_total += (stage_end.tv_sec - stage_start.tv_sec) + (stage_end.tv_nsec - stage_start.tv_nsec) / 1e9;
+
+        if (have_frame) {
+            // Stage 2: Render the frame
+            clock_gettime(CLOCK_MONOTONIC, &stage_start);
+
+            if (resized) {
+                get_terminal_size(&term_rows, &term_cols);
+                clear_terminal();  // Only clear on resize
+                resized = false;
+            }
+
+            CachedPixel *cached_img = cached_image_pool[0][live_front_slot];
+            int frame_width = frame_pool[0][live_front_slot]->width;
+            int frame_height = frame_pool[0][live_front_slot]->height;
+            if (frame_width != last_frame_width || frame_height != last_frame_height) {
+                clear_terminal();  // The character grid may change shape with a new crop
+                last_frame_width = frame_width;
+                last_frame_height = frame_height;
+            }
+
+            DebugInfo debug_info = {0};
+            if (frame_count % fps_calculation_window == 0 && frame_count > 0) {
+                debug_info.has_fps_info = true;
+                debug_info.avg_fps = fps_calculation_window / (total_elapsed_time + 1e-9);
+                debug_info.avg_frame_delay = (total_elapsed_time / fps_calculation_window) * 1000.0;
+                total_elapsed_time = 0.0;
+            }
+
+            // The debug line is part of the frame being written, so it can only show the previous frame's latency
+            struct timespec input_time = live_input_time[live_front_slot];
+            if (last_latency >= 0) {
+                debug_info.has_latency = true;
+                debug_info.latency_ms = last_latency * 1000.0;
+            }
+
+            int grid_width, grid_height;
+            const CachedPixel *grid = frame_render_grid(cached_img,
+                                                        live_grid_width[live_front_slot] ? live_grid_width[live_front_slot] : frame_width,
+                                                        live_grid_height[live_front_slot] ? live_grid_height[live_front_slot] : frame_height,
+                                                        frame_width, frame_height, term_rows, term_cols, &grid_width, &grid_height);
+            if (grid) {
+                render_ascii_grid_terminal(grid, grid_width, grid_height, frame_width, frame_height,
+                                           term_rows, term_cols, ASCII_CHARS_DEFAULT, ascii_map_size_default, &debug_info);
+            }
+
+            clock_gettime(CLOCK_MONOTONIC, &stage_end);
+            render_total += (stage_end.tv_sec - stage_start.tv_sec) + (stage_end.tv_nsec - stage_start.tv_nsec) / 1e9;
+
+            // Input-to-display latency: from reading the frame's packet until its text has been flushed to the terminal
+            double latency = (stage_end.tv_sec - input_time.tv_sec) + (stage_end.tv_nsec - input_time.tv_nsec) / 1e9;
+            last_latency = latency;
+            live_latency_total += latency;
+            if (latency > live_latency_max) {
+                live_latency_max = latency;
+            }
+
+            double frame_elapsed_time =
+                    (stage_end.tv_sec - previous_time.tv_sec) + (stage_end.tv_nsec - previous_time.tv_nsec) / 1e9;
+            if (frame_elapsed_time > 0) {
+                total_elapsed_time += frame_elapsed_time;
+                frame_count++;
+            }
+            previous_time = stage_end;
+
+            consumer_frame_count++;
+
+            key_count = poll_keys(keys, sizeof(keys), 0);
+        }
+
+        // Live sources cannot seek or change speed; quit and the view keys still apply
+        if (key_count > 0 && keys[0] == 'q') {
+            quit_playback();
+        } else if (key_count > 0) {
+            handle_view_key(keys[0]);
+        }
+    }
+
+    consumer_lock_wait_total += lock_wait_total;
+    consumer_render_total += render_total;
+
+    pthread_exit(NULL);
+}
+
+// Signal handler function
+void handle_sigint(int sig) {
+    (void)sig;  // Suppress unused parameter warning
+    terminated = true;
+
+     // Show the cursor before exiting
+    printf("\033[?25h");
+    fflush(stdout);
+
+    print_profiling_results();  // Print whatever profiling data we have so far
+    exit(0);
+}
+
+void setup_signal_handler() {
+    struct sigaction sa;
+    sa.sa_handler = handle_sigint;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+
+    if (sigaction(SIGINT, &sa, NULL) == -1) {
+        perror("Error setting up SIGINT handler");
+        exit(1);
+    }
+
+    // Handle terminal resize (SIGWINCH)
+    sa.sa_handler = handle_resize;  // For resizing the terminal
+    if (sigaction(SIGWINCH, &sa, NULL) == -1) {
+        perror("Error setting up SIGWINCH handler");
+        exit(1);
+    }
+}
+
+pthread_mutex_t cleanup_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void cleanup_resources() {
+    pthread_mutex_lock(&cleanup_mutex);
+
+    static bool is_cleanup_done = false;
+    if (is_cleanup_done) {
+        pthread_mutex_unlock(&cleanup_mutex);
+        return;
+    }
+
+    // Free frame pool, buffer pool, and cached image pool for each producer
+    for (int p = 0; p < NUM_PRODUCERS; ++p) {
+        for (int i = 0; i < BUFFER_POOL_SIZE; ++i) {
+            // Free frame pool for each producer
+            if (frame_pool[p][i]) {
+                av_frame_free(&frame_pool[p][i]);
+                frame_pool[p][i] = NULL; // Set pointer to NULL after freeing
+            }
+
+            // Free buffer pool for each producer
+            if (buffer_pool[p][i]) {
+                av_free(buffer_pool[p][i]);
+                buffer_pool[p][i] = NULL; // Set pointer to NULL after freeing
+            }
+
+            // Free cached image pool for each producer
+            if (cached_image_pool[p][i]) {
+                free(cached_image_pool[p][i]);
+                cached_image_pool[p][i] = NULL; // Set pointer to NULL after freeing
+            }
+        }
+    }
+
+    is_cleanup_done = true;
+
+    pthread_mutex_unlock(&cleanup_mutex);
+}
+
+void process_video(const char *filename) {
+    AVFormatContext *pFormatContext = NULL;
+    AVCodecContext *pCodecContext = NULL;
+    int video_stream_index = -1;
+
+    // A valid sidecar index lets init_ffmpeg skip probing
+    SidecarIndex *index = NULL;
+    if (use_sidecar_index && sidecar_index_load(filename, &sidecar_index) == 0) {
+        index = &sidecar_index;
+    }
+
+    // Initialize FFmpeg and open the input video file
+    print_timestamp("Initializing FFmpeg...");
+    if (init_ffmpeg(filename, &pFormatContext, &pCodecContext, &video_stream_index, index) != 0) {
+        // Initialization failed, exit the function
+        sidecar_index_free(&sidecar_index);
+        stream_input_close(&stream_input);
+        return;
+    }
+
+    // Without a usable index, build one during this playback
+    if (use_sidecar_index && !sidecar_index.is_loaded) {
+        index_recording = sidecar_index_begin(&sidecar_index, filename, pFormatContext, pCodecContext, video_stream_index) == 0;
+    }
+
+    // Print additional video information
+    const char *extension = strrchr(filename, '.');
+    if (!extension) extension = "unknown";
+
+    // Prepare render context for video
+    // With a bounded probe r_frame_rate may not be known yet, so fall back to the average rate
+    AVStream *video_stream = pFormatContext->streams[video_stream_index];
+    double fps = av_q2d(video_stream->r_frame_rate);
+    if (video_stream->r_frame_rate.den == 0 || fps <= 0) {
+        fps = video_stream->avg_frame_rate.den ? av_q2d(video_stream->avg_frame_rate) : 0;
+    }
+    if (fps <= 0) {
+        fps = 25.0;
+    }
+    double frame_delay = 1000.0 / fps;
+
+    clear_terminal();
+    printf("Video Extension: %s\n", extension);
+    printf("Target FPS: %.2f\n", fps);
+    printf("Frame Time (ms): %.2f\n", frame_delay);
+    printf("Input Pixel Format: %s\n", av_get_pix_fmt_name(pCodecContext->pix_fmt));
+    if (sidecar_index.is_loaded) {
+        printf("Index: %u frames, %u keyframes, %.0f kbit/s (probing skipped)\n",
+               sidecar_index.header.frame_count, sidecar_index.header.keyframe_count,
+               video_stream->codecpar->bit_rate / 1000.0);
+    }
+    fflush(stdout);
+
+    // Create producer and consumer threads
+    pthread_t producer_threads[NUM_PRODUCERS], consumer_thread;
+
+    // Prepare arguments for the producer and consumer
+    ProducerArgs producer_args[NUM_PRODUCERS];
+    for (int i = 0; i < NUM_PRODUCERS; ++i) {
+        producer_args[i].pFormatContext = pFormatContext;
+
+        // Create a separate codec context for each producer
+        producer_args[i].pCodecContext = avcodec_alloc_context3(pCodecContext->codec);
+        if (!producer_args[i].pCodecContext) {
+            fprintf(stderr, "Failed to allocate codec context for producer %d\n", i);
+            exit(1);
+        }
+
+        if (avcodec_parameters_to_context(producer_args[i].pCodecContext, pFormatContext->streams[video_stream_index]->codecpar) < 0) {
+            fprintf(stderr, "Failed to copy codec parameters for producer %d\n", i);
+            exit(1);
+        }
+        if (live_mode) {
+            // Output each frame as soon as it is decoded rather than after the reorder delay
+            producer_args[i].pCodecContext->flags |= AV_CODEC_FLAG_LOW_DELAY;
+        }
+
+        if (avcodec_open2(producer_args[i].pCodecContext, pCodecContext->codec, NULL) < 0) {
+            fprintf(stderr, "Failed to open codec for producer %d\n", i);
+            exit(1);
+        }
+
+        producer_args[i].video_stream_index = video_stream_index;
+        producer_args[i].producer_id = i;
+        producer_args[i].fps = fps;
+
+        pthread_create(&producer_threads[i], NULL, frame_producer, &producer_args[i]);
+    }
+
+    ConsumerArgs consumer_args = {
+        .pCodecContext_width = pCodecContext->width,
+        .pCodecContext_height = pCodecContext->height,
+        .fps = fps,
+        .time_base = video_stream->time_base,
+        .start_time = video_stream->start_time != AV_NOPTS_VALUE ? video_stream->start_time : 0,
+        .seekable = stream_input.fd < 0  // Pipes are read through an AVIOContext without a seek callback
+    };
+
+    // --crop is given in source pixels
+    apply_initial_crop(pCodecContext->width, pCodecContext->height);
+
+    // Pool slots are allocated lazily by the producers, so the consumer can start right away
+    // Create consumer thread
+    pthread_create(&consumer_thread, NULL, live_mode ? live_frame_consumer : frame_consumer, &consumer_args);
+
+    // Wait for producer and consumer threads to finish
+    for (int i = 0; i < NUM_PRODUCERS; ++i) {
+        pthread_join(producer_threads[i], NULL);
+    }
+    pthread_join(consumer_thread, NULL);
+
+    // Print profiling results after both threads finish
+    print_profiling_results();
+
+    // A full uninterrupted pass produced a complete index, save it for next time
+    if (index_pass_complete && sidecar_index_write(filename, &sidecar_index) == 0) {
+        printf("Index saved: %s%s\n", filename, SIDECAR_INDEX_SUFFIX);
+    }
+    sidecar_index_free(&sidecar_index);
+    loop_cache_free();
+
+    // Cleanup FFmpeg resources
+    avcodec_free_context(&pCodecContext);
+    avformat_close_input(&pFormatContext);
+    stream_input_close(&stream_input);
+
+    // Free frame pool and buffer pool
+    cleanup_resources();
 }
 
-// Consumer thread function: Renders frames to terminal
-void *frame_consumer(void *args) {
-    ConsumerArgs *cons_args = (ConsumerArgs *)args;
-    int pCodecContext_width = cons_args->pCodecContext_width;
-    int pCodecContext_height = cons_args->pCodecContext_height;
+// Build the sidecar index for a video by demuxing it once, without decoding
+int build_sidecar_index(const char *filename) {
+    AVFormatContext *pFormatContext = NULL;
+    AVCodecContext *pCodecContext = NULL;
+    int video_stream_index = -1;
 
-    struct timespec previous_time, current_time;
-    double total_elapsed_time = 0.0;
-    int frame_count = 0;
-    const int fps_calculation_window = 10;  // Calculate FPS every 10 frames
+    if (init_ffmpeg(filename, &pFormatContext, &pCodecContext, &video_stream_index, NULL) != 0) {
+        return 1;
+    }
 
-    // Profiling variables for different consumer stages
-    double lock_wait_total = 0.0;
-    double render_total = 0.0;
-    double buffer_update_total = 0.0;
+    if (sidecar_index_begin(&sidecar_index, filename, pFormatContext, pCodecContext, video_stream_index) != 0) {
+        fprintf(stderr, "Error: Cannot index %s (not a regular file).\n", filename);
+        avcodec_free_context(&pCodecContext);
+        avformat_close_input(&pFormatContext);
+        return 1;
+    }
 
-    // Start time for FPS calculation
-    clock_gettime(CLOCK_MONOTONIC, &previous_time);
+    AVPacket *packet = av_packet_alloc();
+    while (packet && av_read_frame(pFormatContext, packet) >= 0) {
+        if (packet->stream_index == video_stream_index) {
+            sidecar_index_add_packet(&sidecar_index, packet);
+        }
+        av_packet_unref(packet);
+    }
+    av_packet_free(&packet);
 
-    int current_buffer = 0; // 0 for Buffer A, 1 for Buffer B
+    int ret = sidecar_index_write(filename, &sidecar_index);
+    if (ret == 0) {
+        printf("Indexed %u frames, %u keyframes: %s%s\n", sidecar_index.header.frame_count,
+               sidecar_index.header.keyframe_count, filename, SIDECAR_INDEX_SUFFIX);
+    }
+
+    sidecar_index_free(&sidecar_index);
+    avcodec_free_context(&pCodecContext);
+    avformat_close_input(&pFormatContext);
+    return ret == 0 ? 0 : 1;
+}
 
+// Number of frames in a GIF, counted by walking its blocks without decoding any image data; 0 if data is not a GIF
+int gif_frame_count(const uint8_t *data, size_t size) {
+    if (size < 13 || (memcmp(data, "GIF87a", 6) != 0 && memcmp(data, "GIF89a", 6) != 0)) {
+        return 0;
+    }
+
+    size_t pos = 13;  // Signature and logical screen descriptor
+    if (data[10] & 0x80) {
+        pos += (size_t)3 << ((data[10] & 7) + 1);  // Global colour table
+    }
+
+    int frame_count = 0;
+    while (pos < size && data[pos] != 0x3B) {  // Until the trailer
+        if (data[pos] == 0x2C) {
+            // Image descriptor, local colour table and LZW code size; the image data follows as sub-blocks
+            if (pos + 10 > size) {
+                break;
+            }
+            uint8_t flags = data[pos + 9];
+            pos += 10;
+            if (flags & 0x80) {
+                pos += (size_t)3 << ((flags & 7) + 1);
+            }
+            pos++;
+            frame_count++;
+        } else if (data[pos] == 0x21) {
+            pos += 2;  // Extension introducer and label; the extension data follows as sub-blocks
+        } else {
+            break;  // Corrupt; count what was found so far
+        }
+
+        while (pos < size && data[pos] != 0) {
+            pos += (size_t)data[pos] + 1;
+        }
+        pos++;  // Block terminator
+    }
+    return frame_count;
+}
+
+// Animated GIF: decode every frame once, keep only its render grid in the loop cache and replay the grids with
+// the GIF's own delays. stb holds all decoded frames at full size until they are reduced, so the caller checks
+// the animation fits GIF_DECODE_MAX_BYTES first.
+// Returns false without playing when fewer than two frames could be decoded.
+bool play_animated_gif(const uint8_t *data, size_t size, const char *char_set, int char_set_size) {
     int term_rows, term_cols;
     get_terminal_size(&term_rows, &term_cols);
-    clear_terminal();
 
-    set_nonblocking_input();  // Set terminal input to non-blocking
+    struct timespec decode_start, cache_start, cache_end;
+    clock_gettime(CLOCK_MONOTONIC, &decode_start);
+    int *delays = NULL;
+    int width, height, frames, comp;
+    uint8_t *rgba = stbi_load_gif_from_memory(data, (int)size, &delays, &width, &height, &frames, &comp, 4);
+    clock_gettime(CLOCK_MONOTONIC, &cache_start);
+    double decode_time = (cache_start.tv_sec - decode_start.tv_sec) + (cache_start.tv_nsec - decode_start.tv_nsec) / 1e9;
+    producer_read_frame_total_time += decode_time;
+    producer_total_time += decode_time;
+
+    CachedPixel *frame_pixels = rgba ? malloc((size_t)width * height * sizeof(CachedPixel)) : NULL;
+    for (int frame_index = 0; frame_pixels && frame_index < frames; frame_index++) {
+        clock_gettime(CLOCK_MONOTONIC, &cache_start);
+
+        // Transparent pixels are composited over the terminal's black background
+        const uint8_t *frame = rgba + (size_t)frame_index * width * height * 4;
+        for (size_t i = 0; i < (size_t)width * height; i++) {
+            const uint8_t *px = frame + i * 4;
+            int r = px[0] * px[3] / 255, g = px[1] * px[3] / 255, b = px[2] * px[3] / 255;
+            frame_pixels[i] = (CachedPixel){r, g, b, luma_from_rgb(r, g, b)};
+        }
 
-    while (is_running && !terminated) {
-        struct timespec stage_start, stage_end;
+        int grid_width, grid_height;
+        compute_render_grid_size(width, height, term_rows, term_cols, &grid_width, &grid_height);
+        CachedPixel *cells = malloc((size_t)grid_width * grid_height * sizeof(CachedPixel));
+        if (!cells) {
+            break;
+        }
+        sample_render_grid(frame_pixels, width, width, height, cells, grid_width, grid_height);
 
-        // Stage 1: Lock and wait for frame availability
-        clock_gettime(CLOCK_MONOTONIC, &stage_start);
+        // Browsers show frames with a delay under 20 ms for 100 ms; GIFs are authored against that
+        int delay_ms = delays[frame_index] < 20 ? 100 : delays[frame_index];
+        loop_cache_append(cells, grid_width, grid_height, width, height, frame_index, delay_ms / 1000.0);
+        clock_gettime(CLOCK_MONOTONIC, &cache_end);
 
-        pthread_mutex_lock(&buffer_mutex);
+        double cache_time = (cache_end.tv_sec - cache_start.tv_sec) + (cache_end.tv_nsec - cache_start.tv_nsec) / 1e9;
+        producer_cache_total_time += cache_time;
+        producer_total_time += cache_time;
+        producer_frame_count++;
 
-        // Wait until there's a frame ready to consume or the producer signals completion
-        while (!frame_buffer[current_buffer][buffer_read_index].is_ready && !is_done) {
-            pthread_cond_wait(&buffer_cond, &buffer_mutex);
+        if (!loop_cache_valid) {
+            fprintf(stderr, "Warning: GIF exceeds the loop cache budget, playing the first %d frames.\n", loop_cache_count);
+            break;
+        }
+    }
+
+    free(frame_pixels);
+    stbi_image_free(rgba);
+    stbi_image_free(delays);
+
+    if (loop_cache_count < 2) {
+        // The caller renders the first frame through the still image path instead
+        loop_cache_free();
+        loop_cache_valid = true;
+        producer_frame_count = 0;
+        producer_read_frame_total_time = producer_cache_total_time = producer_total_time = 0.0;
+        return false;
+    }
+
+    set_nonblocking_input();
+    clear_terminal();
+    play_loop_cache(term_rows, term_cols, char_set, char_set_size);
+    loop_cache_free();
+    return true;
+}
+
+// Read a whole file into memory
+uint8_t *read_file(const char *filename, size_t *size) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        return NULL;
+    }
+
+    uint8_t *data = NULL;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        long length = ftell(file);
+        if (length >= 0 && fseek(file, 0, SEEK_SET) == 0) {
+            data = malloc(length > 0 ? (size_t)length : 1);
+            if (data && fread(data, 1, (size_t)length, file) != (size_t)length) {
+                free(data);
+                data = NULL;
+            }
+            *size = (size_t)length;
         }
+    }
+    fclose(file);
+    return data;
+}
 
-        // If producer is done and there are no more frames left, exit the loop
-        if (is_done && !frame_buffer[current_buffer][buffer_read_index].is_ready) {
-            pthread_mutex_unlock(&buffer_mutex);
-            break;
+// Read the next header number of a PNM file, skipping whitespace and comments
+int pnm_read_number(FILE *file, int64_t *value) {
+    int c = fgetc(file);
+    while (c == '#' || c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+        if (c == '#') {
+            while (c != '\n' && c != EOF) {
+                c = fgetc(file);
+            }
         }
+        c = fgetc(file);
+    }
 
-        clock_gettime(CLOCK_MONOTONIC, &stage_end);
-        lock_wait_total += (stage_end.tv_sec - stage_start.tv_sec) + (stage_end.tv_nsec - stage_start.tv_nsec) / 1e9;
+    if (c < '0' || c > '9') {
+        return -1;
+    }
+    *value = 0;
+    while (c >= '0' && c <= '9') {
+        *value = *value * 10 + (c - '0');
+        if (*value > INT32_MAX) {
+            return -1;
+        }
+        c = fgetc(file);
+    }
+    return 0;  // The single whitespace after the number has been consumed
+}
 
-        // Stage 2: Render the frame
-        clock_gettime(CLOCK_MONOTONIC, &stage_start);
+uint32_t read_le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
 
-        // Handle terminal resize if necessary
-        if (resized) {
-            get_terminal_size(&term_rows, &term_cols);
-            clear_terminal();  // Only clear on resize
-            resized = false;
+// Canvas size of a WebP file from its first RIFF chunk, and whether it is animated (the VP8X animation flag, set
+// whenever an ANIM chunk follows); -1 if the file is not WebP. Only the headers are read.
+int webp_file_info(const char *filename, int *width, int *height, bool *animated) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        return -1;
+    }
+    uint8_t header[30] = {0};  // RIFF header, first chunk header and the first 10 bytes of its data
+    size_t header_size = fread(header, 1, sizeof(header), file);
+    fclose(file);
+    if (header_size < 25 || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WEBP", 4) != 0) {
+        return -1;
+    }
+
+    const uint8_t *data = header + 20;
+    *animated = false;
+    if (memcmp(header + 12, "VP8X", 4) == 0 && header_size == sizeof(header)) {
+        *animated = (data[0] & 0x02) != 0;
+        *width = 1 + (data[4] | (data[5] << 8) | (data[6] << 16));
+        *height = 1 + (data[7] | (data[8] << 8) | (data[9] << 16));
+    } else if (memcmp(header + 12, "VP8 ", 4) == 0 && header_size == sizeof(header) &&
+               data[3] == 0x9D && data[4] == 0x01 && data[5] == 0x2A) {
+        *width = (data[6] | (data[7] << 8)) & 0x3FFF;
+        *height = (data[8] | (data[9] << 8)) & 0x3FFF;
+    } else if (memcmp(header + 12, "VP8L", 4) == 0 && data[0] == 0x2F) {
+        uint32_t bits = read_le32(data + 1);
+        *width = (int)(bits & 0x3FFF) + 1;
+        *height = (int)((bits >> 14) & 0x3FFF) + 1;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Open a binary PGM/PPM (8-bit) or uncompressed 24/32-bit BMP for strip reading; -1 for anything else
+int raster_file_open(const char *filename, RasterFile *raster) {
+    memset(raster, 0, sizeof(*raster));
+    raster->file = fopen(filename, "rb");
+    if (!raster->file) {
+        return -1;
+    }
+
+    uint8_t header[66];  // BMP file and info headers, then the colour masks of a BI_BITFIELDS image
+    size_t header_size = fread(header, 1, sizeof(header), raster->file);
+
+    if (header_size >= 2 && header[0] == 'P' && (header[1] == '5' || header[1] == '6')) {
+        int64_t width, height, max_value;
+        fseeko(raster->file, 2, SEEK_SET);
+        if (pnm_read_number(raster->file, &width) == 0 && pnm_read_number(raster->file, &height) == 0 &&
+            pnm_read_number(raster->file, &max_value) == 0 && max_value > 0 && max_value < 256 && width > 0 && height > 0) {
+            raster->width = (int)width;
+            raster->height = (int)height;
+            raster->bytes_per_pixel = header[1] == '5' ? 1 : 3;
+            raster->data_offset = ftello(raster->file);
+            raster->row_stride = (int64_t)raster->width * raster->bytes_per_pixel;
+            return 0;
+        }
+    } else if (header_size >= 54 && header[0] == 'B' && header[1] == 'M') {
+        uint32_t info_size = read_le32(header + 14);
+        int32_t width = (int32_t)read_le32(header + 18);
+        int32_t height = (int32_t)read_le32(header + 22);
+        int bits = header[28] | (header[29] << 8);
+        uint32_t compression = read_le32(header + 30);
+        // BI_BITFIELDS masks follow a 40-byte info header and sit at the same offset inside the larger ones
+        bool bgra_masks = header_size >= 66 && read_le32(header + 54) == 0x00FF0000 &&
+                          read_le32(header + 58) == 0x0000FF00 && read_le32(header + 62) == 0x000000FF;
+        // BITMAPINFOHEADER or later (not the 12-byte OS/2 core header), with BI_RGB or BI_BITFIELDS with the
+        // usual BGRA masks for 32-bit
+        if (info_size >= 40 && width > 0 && height != 0 && height != INT32_MIN &&
+            ((bits == 24 && compression == 0) || (bits == 32 && (compression == 0 || (compression == 3 && bgra_masks))))) {
+            raster->width = width;
+            raster->height = height < 0 ? -height : height;
+            raster->bytes_per_pixel = bits / 8;
+            raster->bgr = true;
+            raster->bottom_up = height > 0;
+            raster->data_offset = read_le32(header + 10);
+            raster->row_stride = ((int64_t)width * bits + 31) / 32 * 4;
+            return 0;
         }
+    }
 
-        // Consume the frame
-        CachedPixel *cached_img = frame_buffer[current_buffer][buffer_read_index].cached_img;
+    fclose(raster->file);
+    raster->file = NULL;
+    return -1;
+}
 
-        DebugInfo debug_info = {0};
+void raster_file_close(RasterFile *raster) {
+    if (raster->file) {
+        fclose(raster->file);
+        raster->file = NULL;
+    }
+}
 
-        if (frame_count % fps_calculation_window == 0 && frame_count > 0) {
-            // Calculate FPS only if we have enough frames and avoid division by zero
-            double avg_fps = fps_calculation_window / (total_elapsed_time + 1e-9);  // Add a small epsilon to avoid zero
-            double avg_frame_delay = (total_elapsed_time / fps_calculation_window) * 1000.0;  // in milliseconds
+// Read image row y (top-down) into row, width * bytes_per_pixel bytes
+int raster_read_row(RasterFile *raster, int y, uint8_t *row) {
+    int64_t stored_row = raster->bottom_up ? raster->height - 1 - y : y;
+    size_t row_bytes = (size_t)raster->width * raster->bytes_per_pixel;
+    if (fseeko(raster->file, raster->data_offset + stored_row * raster->row_stride, SEEK_SET) != 0 ||
+        fread(row, 1, row_bytes, raster->file) != row_bytes) {
+        return -1;
+    }
+    return 0;
+}
 
-            debug_info.has_fps_info = true;
-            debug_info.avg_fps = avg_fps;
-            debug_info.avg_frame_delay = avg_frame_delay;
+// Smallest integer reduction that brings the image within the still image pixel budget
+int still_image_reduction(int width, int height) {
+    int factor = 1;
+    while ((uint64_t)((width + factor - 1) / factor) * ((height + factor - 1) / factor) > STILL_IMAGE_PIXEL_BUDGET) {
+        factor++;
+    }
+    return factor;
+}
 
-            // Reset for the next calculation window
-            total_elapsed_time = 0.0;
+// Box-reduce a raster file by factor along each axis while reading it one strip of factor rows at a time.
+// Peak memory is one row, one row of channel sums and the reduced image, whatever the source size.
+CachedPixel *reduce_raster_file(RasterFile *raster, int factor, int *out_width, int *out_height) {
+    int width = raster->width, height = raster->height;
+    *out_width = (width + factor - 1) / factor;
+    *out_height = (height + factor - 1) / factor;
+
+    CachedPixel *reduced = malloc((size_t)*out_width * *out_height * sizeof(CachedPixel));
+    uint8_t *row = malloc((size_t)width * raster->bytes_per_pixel);
+    uint64_t *sums = malloc((size_t)*out_width * 3 * sizeof(uint64_t));
+    if (!reduced || !row || !sums) {
+        free(reduced);
+        free(row);
+        free(sums);
+        return NULL;
+    }
+
+    int red = raster->bgr ? 2 : 0, blue = raster->bgr ? 0 : 2;
+    for (int out_y = 0; out_y < *out_height; out_y++) {
+        memset(sums, 0, (size_t)*out_width * 3 * sizeof(uint64_t));
+        int strip_start = out_y * factor;
+        int strip_rows = height - strip_start < factor ? height - strip_start : factor;
+
+        for (int y = strip_start; y < strip_start + strip_rows; y++) {
+            if (raster_read_row(raster, y, row) != 0) {
+                fprintf(stderr, "Error: Truncated image data at row %d.\n", y);
+                free(reduced);
+                reduced = NULL;
+                goto done;
+            }
+            for (int x = 0; x < width; x++) {
+                const uint8_t *px = row + (size_t)x * raster->bytes_per_pixel;
+                uint64_t *sum = sums + (size_t)(x / factor) * 3;
+                if (raster->bytes_per_pixel == 1) {
+                    sum[0] += px[0];
+                    sum[1] += px[0];
+                    sum[2] += px[0];
+                } else {
+                    sum[0] += px[red];
+                    sum[1] += px[1];
+                    sum[2] += px[blue];
+                }
+            }
         }
 
-        // Render the frame to the terminal
-        render_ascii_art_terminal(cached_img, pCodecContext_width, pCodecContext_height, term_rows, term_cols,
-                                  ASCII_CHARS_DEFAULT, ascii_map_size_default, &debug_info);
+        for (int out_x = 0; out_x < *out_width; out_x++) {
+            int strip_cols = width - out_x * factor < factor ? width - out_x * factor : factor;
+            uint64_t count = (uint64_t)strip_rows * strip_cols;
+            const uint64_t *sum = sums + (size_t)out_x * 3;
+            uint8_t r = sum[0] / count, g = sum[1] / count, b = sum[2] / count;
+            reduced[(size_t)out_y * *out_width + out_x] = (CachedPixel){r, g, b, luma_from_rgb(r, g, b)};
+        }
+    }
 
-        clock_gettime(CLOCK_MONOTONIC, &stage_end);
-        render_total += (stage_end.tv_sec - stage_start.tv_sec) + (stage_end.tv_nsec - stage_start.tv_nsec) / 1e9;
+done:
+    free(row);
+    free(sums);
+    return reduced;
+}
 
-        // Stage 3: Update buffer indices
-        clock_gettime(CLOCK_MONOTONIC, &stage_start);
+// Decode a large compressed image with libavcodec and let swscale area-filter it straight to the reduced size.
+// The decoder still holds the frame in its native format, but the full-size RGB and cached copies are skipped.
+// lowres asks decoders that support it (JPEG) to decode at 1/2^lowres scale; factor then applies to that size.
+CachedPixel *reduce_image_with_ffmpeg(const char *filename, int lowres, int factor, int *out_width, int *out_height) {
+    AVFormatContext *pFormatContext = NULL;
+    AVCodecContext *pCodecContext = NULL;
+    int video_stream_index = -1;
+    CachedPixel *reduced = NULL;
 
-        // Mark frame as consumed and update the read index
-        frame_buffer[current_buffer][buffer_read_index].is_ready = 0;
-        buffer_read_index = (buffer_read_index + 1) % BUFFER_POOL_SIZE;
+    image_decode_lowres = lowres;
+    int result = init_ffmpeg(filename, &pFormatContext, &pCodecContext, &video_stream_index, NULL);
+    image_decode_lowres = 0;
+    if (result != 0) {
+        return NULL;
+    }
 
-        // Switch buffer after consuming all slots
-        if (buffer_read_index == 0) {
-            current_buffer = 1 - current_buffer;
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    bool decoded = false;
+    while (packet && frame && !decoded && av_read_frame(pFormatContext, packet) >= 0) {
+        if (packet->stream_index == video_stream_index && avcodec_send_packet(pCodecContext, packet) == 0) {
+            decoded = avcodec_receive_frame(pCodecContext, frame) == 0;
         }
+        av_packet_unref(packet);
+    }
+    if (!decoded && frame && avcodec_send_packet(pCodecContext, NULL) == 0) {
+        decoded = avcodec_receive_frame(pCodecContext, frame) == 0;  // Decoders with a delay return the image on flush
+    }
 
-        pthread_cond_signal(&buffer_cond);
-        pthread_mutex_unlock(&buffer_mutex);
+    if (decoded) {
+        *out_width = (frame->width + factor - 1) / factor;
+        *out_height = (frame->height + factor - 1) / factor;
+        struct SwsContext *sws_ctx = sws_getContext(frame->width, frame->height, frame->format,
+                                                    *out_width, *out_height, AV_PIX_FMT_RGB24, SWS_AREA, NULL, NULL, NULL);
+        uint8_t *rgb = malloc((size_t)*out_width * *out_height * 3);
+        reduced = malloc((size_t)*out_width * *out_height * sizeof(CachedPixel));
+        if (sws_ctx && rgb && reduced) {
+            uint8_t *rgb_planes[4] = {rgb, NULL, NULL, NULL};
+            int rgb_linesize[4] = {*out_width * 3, 0, 0, 0};
+            sws_scale(sws_ctx, (const uint8_t *const *)frame->data, frame->linesize, 0, frame->height, rgb_planes, rgb_linesize);
+            cache_grayscale_values(rgb, *out_width, *out_height, reduced);
+        } else {
+            free(reduced);
+            reduced = NULL;
+        }
+        free(rgb);
+        sws_freeContext(sws_ctx);
+    }
 
-        clock_gettime(CLOCK_MONOTONIC, &stage_end);
-        buffer_update_total += (stage_end.tv_sec - stage_start.tv_sec) + (stage_end.tv_nsec - stage_start.tv_nsec) / 1e9;
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    avcodec_free_context(&pCodecContext);
+    avformat_close_input(&pFormatContext);
+    return reduced;
+}
 
-        // End time for FPS calculation
-        clock_gettime(CLOCK_MONOTONIC, &current_time);
-        double frame_elapsed_time =
-                (current_time.tv_sec - previous_time.tv_sec) + (current_time.tv_nsec - previous_time.tv_nsec) / 1e9;
+// Decode up to limit frames of an image with libavcodec, for formats stb cannot read. Returns the number of frames
+// decoded and the size of the first; 0 if libavcodec cannot decode the file.
+int probe_image_with_ffmpeg(const char *filename, int limit, int *width, int *height) {
+    AVFormatContext *pFormatContext = NULL;
+    AVCodecContext *pCodecContext = NULL;
+    int video_stream_index = -1;
+    if (init_ffmpeg(filename, &pFormatContext, &pCodecContext, &video_stream_index, NULL) != 0) {
+        return 0;
+    }
 
-        // Only accumulate frame_elapsed_time if it's greater than zero to avoid division issues
-        if (frame_elapsed_time > 0) {
-            total_elapsed_time += frame_elapsed_time;
+    // Animated images may come as one packet holding every frame, so drain the decoder after each packet
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    int frame_count = 0;
+    bool flushed = false;
+    while (packet && frame && frame_count < limit && !flushed) {
+        if (av_read_frame(pFormatContext, packet) >= 0) {
+            int sent = packet->stream_index == video_stream_index ? avcodec_send_packet(pCodecContext, packet) : -1;
+            av_packet_unref(packet);
+            if (sent != 0) {
+                continue;
+            }
+        } else {
+            avcodec_send_packet(pCodecContext, NULL);
+            flushed = true;
+        }
+        while (frame_count < limit && avcodec_receive_frame(pCodecContext, frame) == 0) {
+            if (frame_count == 0) {
+                *width = frame->width;
+                *height = frame->height;
+            }
             frame_count++;
         }
+    }
 
-        previous_time = current_time;
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    avcodec_free_context(&pCodecContext);
+    avformat_close_input(&pFormatContext);
+    return frame_count;
+}
 
-        // Profiling
-        consumer_frame_count++;
+// Image size from the header alone, or from a first-frame decode for other formats only libavcodec reads
+bool still_image_info(const char *filename, const uint8_t *data, size_t data_size, int *width, int *height) {
+    int channels;
+    if (data) {
+        return stbi_info_from_memory(data, (int)data_size, width, height, &channels);
+    }
 
-        // Check if 'q' has been pressed to quit using select()
-        fd_set readfds;
-        struct timeval timeout;
+    RasterFile raster;
+    if (raster_file_open(filename, &raster) == 0) {
+        *width = raster.width;
+        *height = raster.height;
+        raster_file_close(&raster);
+        return true;
+    }
+    bool animated;
+    return stbi_info(filename, width, height, &channels) || webp_file_info(filename, width, height, &animated) == 0 ||
+           probe_image_with_ffmpeg(filename, 1, width, height) > 0;
+}
 
-        FD_ZERO(&readfds);
-        FD_SET(STDIN_FILENO, &readfds);
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 5000;  // Timeout of 5ms
+// True if the file starts with a JPEG start-of-image marker
+bool is_jpeg_file(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        return false;
+    }
+    uint8_t magic[3];
+    bool jpeg = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && magic[0] == 0xFF && magic[1] == 0xD8 && magic[2] == 0xFF;
+    fclose(file);
+    return jpeg;
+}
 
-        int retval = select(STDIN_FILENO + 1, &readfds, NULL, NULL, &timeout);
-        if (retval > 0) {
-            char c;
-            if (read(STDIN_FILENO, &c, 1) > 0 && c == 'q') {
-                terminated = true;
-                // Show cursor after finishing video
-                printf("\033[?25h");
-                fflush(stdout);
+// Decode a still image into the packed cache, from memory for piped input and GIFs. A JPEG with lowres > 0 is
+// decoded by libavcodec at 1/2^lowres scale. Very large images are reduced while decoding: uncompressed PNM/BMP
+// rasters a strip at a time; JPEG, PNG and the rest are decoded whole by libavcodec (JPEG at a reduced IDCT
+// scale) and area-scaled by swscale, or by stb when libavcodec refuses the frame size. Everything else goes
+// through stb, or through libavcodec when stb cannot read the format.
+// reduction is the number of source pixels per cached pixel along each axis.
+CachedPixel *load_still_image(const char *filename, const uint8_t *data, size_t data_size, int source_width, int source_height,
+                              int lowres, int *img_width, int *img_height, int *reduction) {
+    *reduction = 1;
+    if (!data && lowres > 0) {
+        int scaled_width = (source_width + (1 << lowres) - 1) >> lowres;
+        int scaled_height = (source_height + (1 << lowres) - 1) >> lowres;
+        int factor = still_image_reduction(scaled_width, scaled_height);
+        CachedPixel *scaled = reduce_image_with_ffmpeg(filename, lowres, factor, img_width, img_height);
+        if (scaled) {
+            *reduction = (source_width + *img_width - 1) / *img_width;
+            return scaled;
+        }
+        // Fall through to a full-size decode
+    }
+    if (!data && (uint64_t)source_width * source_height > STILL_IMAGE_PIXEL_BUDGET) {
+        *reduction = still_image_reduction(source_width, source_height);
+        RasterFile raster;
+        if (raster_file_open(filename, &raster) == 0) {
+            CachedPixel *reduced = reduce_raster_file(&raster, *reduction, img_width, img_height);
+            raster_file_close(&raster);
+            return reduced;
+        }
 
-                print_profiling_results();
-                exit(0);
+        // A JPEG is decoded at up to 1/8 scale in the IDCT, which also keeps it under libavcodec's frame size limit
+        int jpeg_lowres = 0;
+        if (is_jpeg_file(filename)) {
+            while (jpeg_lowres < JPEG_MAX_LOWRES && (2 << jpeg_lowres) <= *reduction) {
+                jpeg_lowres++;
             }
         }
+        int scaled_width = (source_width + (1 << jpeg_lowres) - 1) >> jpeg_lowres;
+        int scaled_height = (source_height + (1 << jpeg_lowres) - 1) >> jpeg_lowres;
+        CachedPixel *reduced = reduce_image_with_ffmpeg(filename, jpeg_lowres, still_image_reduction(scaled_width, scaled_height),
+                                                        img_width, img_height);
+        if (reduced) {
+            *reduction = (source_width + *img_width - 1) / *img_width;
+            return reduced;
+        }
+
+        // libavcodec refuses frames over about 268 megapixels; stb can go further, holding the full-size RGB
+        // only until it is averaged down
+        int channels;
+        uint8_t *pixels = stbi_load(filename, img_width, img_height, &channels, 3);
+        if (!pixels) {
+            fprintf(stderr, "Error: %dx%d image is too large to decode.\n", source_width, source_height);
+            return NULL;
+        }
+        int full_width = *img_width, full_height = *img_height;
+        *img_width = (full_width + *reduction - 1) / *reduction;
+        *img_height = (full_height + *reduction - 1) / *reduction;
+        reduced = malloc((size_t)*img_width * *img_height * sizeof(CachedPixel));
+        if (reduced && rgb24_to_cell_grid(pixels, (size_t)full_width * 3, full_width, full_height, reduced, *img_width, *img_height) != 0) {
+            free(reduced);
+            reduced = NULL;
+        }
+        stbi_image_free(pixels);
+        return reduced;
     }
 
-    // Update global profiling variables for consumer stages
-    consumer_lock_wait_total += lock_wait_total;
-    consumer_render_total += render_total;
-    consumer_buffer_update_total += buffer_update_total;
+    int channels;
+    uint8_t *pixels = data ? stbi_load_from_memory(data, (int)data_size, img_width, img_height, &channels, 3)
+                           : stbi_load(filename, img_width, img_height, &channels, 3);
+    if (!pixels) {
+        return data ? NULL : reduce_image_with_ffmpeg(filename, 0, 1, img_width, img_height);
+    }
 
-    pthread_exit(NULL);
+    CachedPixel *cached = malloc((size_t)*img_width * *img_height * sizeof(CachedPixel));
+    if (cached) {
+        cache_grayscale_values(pixels, *img_width, *img_height, cached);
+    }
+
+    // The packed cache holds everything the renderers need, so drop the decoded RGB buffer right away
+    stbi_image_free(pixels);
+    return cached;
 }
 
-// Signal handler function
-void handle_sigint(int sig) {
-    (void)sig;  // Suppress unused parameter warning
-    terminated = true;
+// Sparse preview of an uncompressed raster: every step-th pixel of every step-th row, with step chosen so the
+// long side comes out near PREVIEW_MAX_DIMENSION
+CachedPixel *sample_raster_preview(RasterFile *raster, int *out_width, int *out_height) {
+    int width = raster->width, height = raster->height;
+    int long_side = width > height ? width : height;
+    int step = (long_side + PREVIEW_MAX_DIMENSION - 1) / PREVIEW_MAX_DIMENSION;
+    *out_width = (width + step - 1) / step;
+    *out_height = (height + step - 1) / step;
+
+    CachedPixel *preview = malloc((size_t)*out_width * *out_height * sizeof(CachedPixel));
+    uint8_t *row = malloc((size_t)width * raster->bytes_per_pixel);
+    if (!preview || !row) {
+        free(preview);
+        free(row);
+        return NULL;
+    }
 
-     // Show the cursor before exiting
-    printf("\033[?25h");
-    fflush(stdout);
+    int red = raster->bgr ? 2 : 0, blue = raster->bgr ? 0 : 2;
+    for (int out_y = 0; out_y < *out_height; out_y++) {
+        if (raster_read_row(raster, out_y * step, row) != 0) {
+            free(preview);
+            preview = NULL;
+            break;
+        }
+        for (int out_x = 0; out_x < *out_width; out_x++) {
+            const uint8_t *px = row + (size_t)out_x * step * raster->bytes_per_pixel;
+            uint8_t r = px[0], g = px[0], b = px[0];
+            if (raster->bytes_per_pixel > 1) {
+                r = px[red];
+                g = px[1];
+                b = px[blue];
+            }
+            preview[(size_t)out_y * *out_width + out_x] = (CachedPixel){r, g, b, luma_from_rgb(r, g, b)};
+        }
+    }
 
-    print_profiling_results();  // Print whatever profiling data we have so far
-    exit(0);
+    free(row);
+    return preview;
 }
 
-void setup_signal_handler() {
-    struct sigaction sa;
-    sa.sa_handler = handle_sigint;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = 0;
+// Smallest JPEG decode scale (largest lowres level) at which the visible region still has at least one decoded
+// pixel per cell of the terminal grid
+int jpeg_lowres_for_grid(int source_width, int source_height, const ViewRegion *view, int term_rows, int term_cols) {
+    PixelRect rect;
+    view_region_to_rect(view, source_width, source_height, 0, 0, &rect);
+    int target_width, target_height;
+    compute_render_grid_size(rect.width, rect.height, term_rows, term_cols, &target_width, &target_height);
+
+    int lowres = 0;
+    while (lowres < JPEG_MAX_LOWRES && (rect.width >> (lowres + 1)) >= target_width &&
+           (rect.height >> (lowres + 1)) >= target_height) {
+        lowres++;
+    }
+    return lowres;
+}
 
-    if (sigaction(SIGINT, &sa, NULL) == -1) {
-        perror("Error setting up SIGINT handler");
-        exit(1);
+// Decode a JPEG again at a finer scale once zooming in or a larger terminal leaves the current decode with fewer
+// pixels than cells in the visible region, replacing the cache and its pyramid. lowres is the
+// level last decoded; a decode that comes out no larger than the current cache is dropped, and not retried.
+void refine_jpeg_decode(const char *filename, int source_width, int source_height, const ViewRegion *view, int term_rows,
+                        int term_cols, int *lowres, CachedPixel **cached_img, int *img_width, int *img_height,
+                        MipPyramid *pyramid) {
+    int needed = jpeg_lowres_for_grid(source_width, source_height, view, term_rows, term_cols);
+    if (needed >= *lowres) {
+        return;
     }
+    *lowres = needed;
 
-    // Handle terminal resize (SIGWINCH)
-    sa.sa_handler = handle_resize;  // For resizing the terminal
-    if (sigaction(SIGWINCH, &sa, NULL) == -1) {
-        perror("Error setting up SIGWINCH handler");
-        exit(1);
+    int width, height, reduction;
+    CachedPixel *refined = load_still_image(filename, NULL, 0, source_width, source_height, needed, &width, &height, &reduction);
+    if (!refined || width <= *img_width) {
+        free(refined);
+        return;
     }
+
+    free_mip_pyramid(pyramid);
+    free(*cached_img);
+    *cached_img = refined;
+    *img_width = width;
+    *img_height = height;
+    build_mip_pyramid(refined, width, height, pyramid);
 }
 
-pthread_mutex_t cleanup_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Quick low-resolution stand-in for a large still image: a sparse sample of an uncompressed raster, or a JPEG
+// decoded at 1/8 scale straight from the DCT coefficients. NULL when the format has no cheap path.
+CachedPixel *load_still_preview(const char *filename, int source_width, int source_height, int *out_width, int *out_height) {
+    RasterFile raster;
+    if (raster_file_open(filename, &raster) == 0) {
+        CachedPixel *preview = sample_raster_preview(&raster, out_width, out_height);
+        raster_file_close(&raster);
+        return preview;
+    }
 
-void cleanup_resources() {
-    pthread_mutex_lock(&cleanup_mutex);
+    if (is_jpeg_file(filename)) {
+        int long_side = (source_width > source_height ? source_width : source_height) >> PREVIEW_JPEG_LOWRES;
+        int factor = (long_side + PREVIEW_MAX_DIMENSION - 1) / PREVIEW_MAX_DIMENSION;
+        return reduce_image_with_ffmpeg(filename, PREVIEW_JPEG_LOWRES, factor > 0 ? factor : 1, out_width, out_height);
+    }
+    return NULL;
+}
 
-    static bool is_cleanup_done = false;
-    if (is_cleanup_done) {
-        pthread_mutex_unlock(&cleanup_mutex);
-        return;
+// True for printf-style frame patterns such as frame_%05d.png
+bool is_image_sequence(const char *filename) {
+    const char *percent = strchr(filename, '%');
+    if (!percent) {
+        return false;
     }
+    const char *conversion = percent + 1;
+    while (*conversion >= '0' && *conversion <= '9') {
+        conversion++;
+    }
+    return *conversion == 'd' && !strchr(conversion, '%');
+}
 
-    // Free frame pool, buffer pool, and cached image pool for each producer
-    for (int p = 0; p < NUM_PRODUCERS; ++p) {
-        for (int i = 0; i < BUFFER_POOL_SIZE; ++i) {
-            // Free frame pool for each producer
-            if (frame_pool[p][i]) {
-                av_frame_free(&frame_pool[p][i]);
-                frame_pool[p][i] = NULL; // Set pointer to NULL after freeing
-            }
+// File name of frame_index (counted from the first file) in the sequence
+void sequence_frame_path(const ImageSequence *sequence, int frame_index, char *path, size_t size) {
+    snprintf(path, size, sequence->pattern, sequence->first_number + frame_index);
+}
 
-            // Free buffer pool for each producer
-            if (buffer_pool[p][i]) {
-                av_free(buffer_pool[p][i]);
-                buffer_pool[p][i] = NULL; // Set pointer to NULL after freeing
-            }
+// Find the first numbered file and count the consecutive frames after it; only stats files
+int open_image_sequence(const char *pattern, ImageSequence *sequence) {
+    char path[4096];
+    struct stat st;
 
-            // Free cached image pool for each producer
-            if (cached_image_pool[p][i]) {
-                free(cached_image_pool[p][i]);
-                cached_image_pool[p][i] = NULL; // Set pointer to NULL after freeing
-            }
+    sequence->pattern = pattern;
+    sequence->fps = sequence_fps;
+    sequence->frame_count = 0;
+
+    for (sequence->first_number = 0; sequence->first_number <= SEQUENCE_START_SEARCH; sequence->first_number++) {
+        sequence_frame_path(sequence, 0, path, sizeof(path));
+        if (stat(path, &st) == 0) {
+            break;
         }
     }
+    if (sequence->first_number > SEQUENCE_START_SEARCH) {
+        fprintf(stderr, "Error: No frames found matching %s\n", pattern);
+        return -1;
+    }
 
-    is_cleanup_done = true;
+    do {
+        sequence->frame_count++;
+        sequence_frame_path(sequence, sequence->frame_count, path, sizeof(path));
+    } while (stat(path, &st) == 0);
 
-    pthread_mutex_unlock(&cleanup_mutex);
+    return 0;
 }
 
-void process_video(const char *filename) {
-    AVFormatContext *pFormatContext = NULL;
-    AVCodecContext *pCodecContext = NULL;
-    int video_stream_index = -1;
-
-    // Initialize FFmpeg and open the input video file
-    if (init_ffmpeg(filename, &pFormatContext, &pCodecContext, &video_stream_index) != 0) {
-        // Initialization failed, exit the function
-        return;
-    }
+// Sequence worker: claims frame numbers in order, decodes them in parallel with the other workers and publishes
+// each one at its own ring position
+void *sequence_worker(void *args) {
+    (void)args;
+    struct timespec decode_start, decode_end, cache_end;
 
-    // Print additional video information
-    const char *extension = strrchr(filename, '.');
-    if (!extension) extension = "unknown";
+    for (;;) {
+        int frame_index = atomic_fetch_add(&sequence_next_frame, 1);
+        if (frame_index >= image_sequence.frame_count || terminated) {
+            break;
+        }
+        int slot = frame_index % BUFFER_POOL_SIZE;
+        int buffer = (frame_index / BUFFER_POOL_SIZE) % NUM_BUFFERS;
 
-    // Prepare render context for video
-    double fps = av_q2d(pFormatContext->streams[video_stream_index]->r_frame_rate);
-    double frame_delay = 1000.0 / fps;
+        // Frame n reuses the pool slot of frame n - BUFFER_POOL_SIZE, so wait until the consumer has released that one
+        pthread_mutex_lock(&buffer_mutex);
+        while (frame_index - frames_released >= BUFFER_POOL_SIZE && !terminated) {
+            pthread_cond_wait(&buffer_cond, &buffer_mutex);
+        }
+        pthread_mutex_unlock(&buffer_mutex);
+        if (terminated) {
+            break;
+        }
 
-    clear_terminal();
-    printf("Video Extension: %s\n", extension);
-    printf("Target FPS: %.2f\n", fps);
-    printf("Frame Time (ms): %.2f\n", frame_delay);
-    printf("Input Pixel Format: %s\n", av_get_pix_fmt_name(pCodecContext->pix_fmt));
-    fflush(stdout);
+        clock_gettime(CLOCK_MONOTONIC, &decode_start);
 
-    // Create producer and consumer threads
-    pthread_t producer_threads[NUM_PRODUCERS], consumer_thread;
+        char path[4096];
+        sequence_frame_path(&image_sequence, frame_index, path, sizeof(path));
+        int width = 0, height = 0, channels;
+        unsigned char *img = stbi_load(path, &width, &height, &channels, 3);
+        if (!img) {
+            fprintf(stderr, "Warning: Failed to load frame: %s\n", path);
+        }
 
-    // Prepare arguments for the producer and consumer
-    ProducerArgs producer_args[NUM_PRODUCERS];
-    for (int i = 0; i < NUM_PRODUCERS; ++i) {
-        producer_args[i].pFormatContext = pFormatContext;
+        clock_gettime(CLOCK_MONOTONIC, &decode_end);
 
-        // Create a separate codec context for each producer
-        producer_args[i].pCodecContext = avcodec_alloc_context3(pCodecContext->codec);
-        if (!producer_args[i].pCodecContext) {
-            fprintf(stderr, "Failed to allocate codec context for producer %d\n", i);
-            exit(1);
+        // Only the view region is cached, so zooming into a sequence frame costs less, not more
+        PixelRect rect = {0, 0, width, height};
+        if (img) {
+            ViewRegion view = get_view_region(NULL);
+            view_region_to_rect(&view, width, height, 0, 0, &rect);
         }
 
-        if (avcodec_parameters_to_context(producer_args[i].pCodecContext, pFormatContext->streams[video_stream_index]->codecpar) < 0) {
-            fprintf(stderr, "Failed to copy codec parameters for producer %d\n", i);
-            exit(1);
+        size_t slot_bytes = (size_t)rect.width * rect.height * sizeof(CachedPixel);
+        if (!frame_pool[0][slot]) {
+            frame_pool[0][slot] = av_frame_alloc();
+        }
+        if (img && slot_bytes > sequence_slot_bytes[slot]) {
+            CachedPixel *grown = realloc(cached_image_pool[0][slot], slot_bytes);
+            if (grown) {
+                cached_image_pool[0][slot] = grown;
+                sequence_slot_bytes[slot] = slot_bytes;
+            }
         }
 
-        if (avcodec_open2(producer_args[i].pCodecContext, pCodecContext->codec, NULL) < 0) {
-            fprintf(stderr, "Failed to open codec for producer %d\n", i);
-            exit(1);
+        // A frame that failed to load or allocate is still published, as stale, so the consumer skips past it
+        bool usable = img && frame_pool[0][slot] && slot_bytes <= sequence_slot_bytes[slot];
+        if (usable) {
+            for (int y = 0; y < rect.height; y++) {
+                cache_grayscale_values(img + ((size_t)(rect.y + y) * width + rect.x) * 3, rect.width, 1,
+                                       cached_image_pool[0][slot] + (size_t)y * rect.width);
+            }
+            frame_pool[0][slot]->width = rect.width;
+            frame_pool[0][slot]->height = rect.height;
+            frame_pool[0][slot]->pts = (int64_t)(frame_index * 1e6 / image_sequence.fps + 0.5);
         }
+        stbi_image_free(img);
 
-        producer_args[i].video_stream_index = video_stream_index;
-        producer_args[i].producer_id = i;
+        clock_gettime(CLOCK_MONOTONIC, &cache_end);
 
-        pthread_create(&producer_threads[i], NULL, frame_producer, &producer_args[i]);
+        pthread_mutex_lock(&buffer_mutex);
+        frame_buffer[buffer][slot].frame = frame_pool[0][slot];
+        frame_buffer[buffer][slot].cached_img = cached_image_pool[0][slot];
+        frame_buffer[buffer][slot].grid_width = frame_buffer[buffer][slot].grid_height = 0;
+        frame_buffer[buffer][slot].generation = usable ? playback_generation : -1;
+        frame_buffer[buffer][slot].is_ready = 1;
+
+        double decode_time = (decode_end.tv_sec - decode_start.tv_sec) + (decode_end.tv_nsec - decode_start.tv_nsec) / 1e9;
+        double cache_time = (cache_end.tv_sec - decode_end.tv_sec) + (cache_end.tv_nsec - decode_end.tv_nsec) / 1e9;
+        producer_read_frame_total_time += decode_time;
+        producer_cache_total_time += cache_time;
+        producer_total_time += decode_time + cache_time;
+        producer_frame_count++;
+
+        pthread_cond_broadcast(&buffer_cond);
+        pthread_mutex_unlock(&buffer_mutex);
+    }
+
+    pthread_mutex_lock(&buffer_mutex);
+    if (--sequence_workers_running == 0) {
+        is_done = true;
+        pthread_cond_broadcast(&buffer_cond);
+    }
+    pthread_mutex_unlock(&buffer_mutex);
+
+    pthread_exit(NULL);
+}
+
+// Play a numbered image sequence through the video consumer, decoding frames on several worker threads
+void process_image_sequence(const char *pattern) {
+    if (open_image_sequence(pattern, &image_sequence) != 0) {
+        return;
     }
 
+    int worker_count = sequence_worker_count > 0 ? sequence_worker_count : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    // More workers than ring slots would only wait for the consumer
+    if (worker_count > SEQUENCE_MAX_WORKERS) worker_count = SEQUENCE_MAX_WORKERS;
+    if (worker_count > BUFFER_POOL_SIZE) worker_count = BUFFER_POOL_SIZE;
+    if (worker_count > image_sequence.frame_count) worker_count = image_sequence.frame_count;
+    if (worker_count < 1) worker_count = 1;
+
+    char path[4096];
+    int width = 0, height = 0, channels;
+    sequence_frame_path(&image_sequence, 0, path, sizeof(path));
+    stbi_info(path, &width, &height, &channels);
+
+    clear_terminal();
+    printf("Image Sequence: %d frames starting at %s\n", image_sequence.frame_count, path);
+    printf("Target FPS: %.2f\n", image_sequence.fps);
+    printf("Frame Time (ms): %.2f\n", 1000.0 / image_sequence.fps);
+    printf("Decode Workers: %d\n", worker_count);
+    fflush(stdout);
+
+    // Timestamps are in microseconds so fractional frame rates stay exact enough for the presentation clock
     ConsumerArgs consumer_args = {
-        .pCodecContext_width = pCodecContext->width,
-        .pCodecContext_height = pCodecContext->height,
-        .fps = fps
+        .pCodecContext_width = width,
+        .pCodecContext_height = height,
+        .fps = image_sequence.fps,
+        .time_base = (AVRational){1, 1000000},
+        .start_time = 0
     };
 
-    // Allocate frames and buffers for the pool
-    for (int p = 0; p < NUM_PRODUCERS; ++p) {
-        for (int i = 0; i < BUFFER_POOL_SIZE; ++i) {
-            // Frame allocation for each producer
-            frame_pool[p][i] = av_frame_alloc();
-            if (!frame_pool[p][i]) {
-                fprintf(stderr, "Failed to allocate frame for pool\n");
-                exit(1);
-            }
-
-            // Buffer allocation for each producer
-            buffer_pool[p][i] = (uint8_t *)av_malloc(av_image_get_buffer_size(AV_PIX_FMT_RGB24, pCodecContext->width, pCodecContext->height, 32));
-            if (!buffer_pool[p][i]) {
-                fprintf(stderr, "Failed to allocate buffer for pool\n");
-                exit(1);
-            }
+    apply_initial_crop(width, height);
 
-            // Cached image pool allocation for each producer
-            cached_image_pool[p][i] = (CachedPixel *)malloc(pCodecContext->width * pCodecContext->height * sizeof(CachedPixel));
-            if (!cached_image_pool[p][i]) {
-                fprintf(stderr, "Failed to allocate cached image for pool\n");
-                exit(1);
-            }
-        }
+    pthread_t worker_threads[SEQUENCE_MAX_WORKERS], consumer_thread;
+    sequence_workers_running = worker_count;
+    for (int i = 0; i < worker_count; i++) {
+        pthread_create(&worker_threads[i], NULL, sequence_worker, NULL);
     }
-
-    // Create consumer thread
     pthread_create(&consumer_thread, NULL, frame_consumer, &consumer_args);
 
-    // Wait for producer and consumer threads to finish
-    for (int i = 0; i < NUM_PRODUCERS; ++i) {
-        pthread_join(producer_threads[i], NULL);
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(worker_threads[i], NULL);
     }
     pthread_join(consumer_thread, NULL);
 
-    // Print profiling results after both threads finish
     print_profiling_results();
-
-    // Cleanup FFmpeg resources
-    avcodec_free_context(&pCodecContext);
-    avformat_close_input(&pFormatContext);
-
-    // Free frame pool and buffer pool
     cleanup_resources();
 }
 
@@ -1077,43 +5191,211 @@ int is_video_file(const char *filename) {
     return 0; // Not a video file
 }
 
+void print_usage(const char *program) {
+    printf("Usage: %s [options] <image or video file, frame pattern, named pipe, or - for stdin>\n", program);
+    printf("Options:\n");
+    printf("  --index      Build the sidecar index (<file>%s) for a video and exit\n", SIDECAR_INDEX_SUFFIX);
+    printf("  --no-index   Do not read or write a sidecar index during playback\n");
+    printf("  --speed <x>  Playback speed for videos, %.2fx to %.0fx (default 1x)\n", MIN_PLAYBACK_SPEED, MAX_PLAYBACK_SPEED);
+    printf("  --crop WxH+X+Y  Start with the view cropped to this source rectangle\n");
+    printf("  --zoom <z>   Start zoomed in by z around the center\n");
+    printf("  --raw WxH    Read the input as raw frames of this size (for pipes from other tools)\n");
+    printf("  --raw-format <fmt>  Pixel format of raw frames, as named by FFmpeg (default rgb24)\n");
+    printf("  --raw-fps <fps>     Frame rate of raw frames (default 25)\n");
+    printf("  --fps <fps>  Frame rate for image sequences such as frame_%%05d.png (default %.0f)\n", SEQUENCE_DEFAULT_FPS);
+    printf("  --workers <n>  Threads decoding image sequence frames (default: one per CPU)\n");
+    printf("  --threads <n>  Threads converting large images and frames to pixels and drawing large PNGs (default: one per CPU)\n");
+    printf("  --format <f> Image file format: png (default), ppm, bmp, qoi or jpg\n");
+    printf("  --png-level <0-9>  PNG compression level (default 6)\n");
+    printf("  --jpeg-quality <1-100>  JPEG quality (default 90)\n");
+    printf("  --benchmark  Time the pixel conversion variants on this CPU and exit\n");
+    printf("  --live       Low-latency mode for cameras and streams: always show the newest frame\n");
+    printf("  --loop       Loop a video, replaying short clips from memory after the first pass\n");
+    printf("  --loop-budget <MB>  Memory allowed for the loop cache (default %d MB)\n", LOOP_CACHE_DEFAULT_BUDGET_MB);
+}
+
 int main(int argc, char *argv[]) {
+    clock_gettime(CLOCK_MONOTONIC, &process_start_time);
     setup_signal_handler();
     CachedPixel *cached_img = NULL;
-    unsigned char *img = NULL;
 
-    if (argc < 2) {
-        printf("Usage: %s <image file>\n", argv[0]);
+    const char *filename = NULL;
+    bool build_index = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--index") == 0) {
+            build_index = true;
+        } else if (strcmp(argv[i], "--benchmark") == 0) {
+            return run_pixel_benchmark();
+        } else if (strcmp(argv[i], "--no-index") == 0) {
+            use_sidecar_index = false;
+        } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            playback_speed = strtod(argv[++i], NULL);
+            if (playback_speed < MIN_PLAYBACK_SPEED || playback_speed > MAX_PLAYBACK_SPEED) {
+                fprintf(stderr, "Error: Playback speed must be between %.2f and %.0f.\n", MIN_PLAYBACK_SPEED, MAX_PLAYBACK_SPEED);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--crop") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d+%d+%d", &initial_crop.width, &initial_crop.height, &initial_crop.x, &initial_crop.y) != 4 ||
+                initial_crop.width <= 0 || initial_crop.height <= 0) {
+                fprintf(stderr, "Error: Invalid crop geometry, expected WxH+X+Y.\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--zoom") == 0 && i + 1 < argc) {
+            double zoom = strtod(argv[++i], NULL);
+            if (zoom < 1.0) {
+                fprintf(stderr, "Error: Zoom must be at least 1.\n");
+                return 1;
+            }
+            set_view_region((ViewRegion){0.5 - 0.5 / zoom, 0.5 - 0.5 / zoom, 1.0 / zoom, 1.0 / zoom});
+        } else if (strcmp(argv[i], "--raw") == 0 && i + 1 < argc) {
+            int raw_width, raw_height;
+            raw_video_size = argv[++i];
+            if (sscanf(raw_video_size, "%dx%d", &raw_width, &raw_height) != 2 || raw_width <= 0 || raw_height <= 0) {
+                fprintf(stderr, "Error: Invalid raw frame size, expected WxH.\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--raw-format") == 0 && i + 1 < argc) {
+            raw_pixel_format = argv[++i];
+        } else if (strcmp(argv[i], "--raw-fps") == 0 && i + 1 < argc) {
+            raw_frame_rate = argv[++i];
+        } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            sequence_fps = strtod(argv[++i], NULL);
+            if (sequence_fps <= 0) {
+                fprintf(stderr, "Error: Frame rate must be positive.\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            sequence_worker_count = (int)strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            cache_thread_count = (int)strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            const char *name = argv[++i];
+            int format = 0;
+            while (format < (int)(sizeof(image_encoders) / sizeof(image_encoders[0])) &&
+                   strcasecmp(name, image_encoders[format].name) != 0) {
+                format++;
+            }
+            if (format == (int)(sizeof(image_encoders) / sizeof(image_encoders[0]))) {
+                fprintf(stderr, "Error: Unknown image format: %s (use png, ppm, bmp, qoi or jpg).\n", name);
+                return 1;
+            }
+            output_format = format;
+        } else if (strcmp(argv[i], "--png-level") == 0 && i + 1 < argc) {
+            png_compression_level = (int)strtol(argv[++i], NULL, 10);
+            if (png_compression_level < 0 || png_compression_level > 9) {
+                fprintf(stderr, "Error: PNG compression level must be 0-9.\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--jpeg-quality") == 0 && i + 1 < argc) {
+            jpeg_quality = (int)strtol(argv[++i], NULL, 10);
+            if (jpeg_quality < 1 || jpeg_quality > 100) {
+                fprintf(stderr, "Error: JPEG quality must be 1-100.\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--live") == 0) {
+            live_mode = true;
+        } else if (strcmp(argv[i], "--loop") == 0) {
+            loop_playback = true;
+        } else if (strcmp(argv[i], "--loop-budget") == 0 && i + 1 < argc) {
+            long budget_mb = strtol(argv[++i], NULL, 10);
+            if (budget_mb <= 0) {
+                fprintf(stderr, "Error: Loop cache budget must be positive.\n");
+                return 1;
+            }
+            loop_cache_budget = (size_t)budget_mb * 1024 * 1024;
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            fprintf(stderr, "Error: Unknown option: %s\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        } else {
+            filename = argv[i];
+        }
+    }
+
+    if (!filename) {
+        print_usage(argv[0]);
         return 1;
     }
 
-    const char *filename = argv[1];
+    // Numbered frames decode in parallel and play through the video consumer
+    if (is_image_sequence(filename)) {
+        loop_playback = false;  // Looping needs a producer that can rewind
+        process_image_sequence(filename);
+        return 0;
+    }
+
+    // Pipes are read once from front to back: no index, and the content type is probed from the first bytes
+    bool stream = is_stream_input(filename);
+    if (stream) {
+        if (build_index) {
+            fprintf(stderr, "Error: Cannot index a pipe.\n");
+            return 1;
+        }
+        use_sidecar_index = false;
+        loop_playback = false;  // Looping needs a producer that can rewind
+        if (stream_input_open(filename, &stream_input) != 0) {
+            return 1;
+        }
+        if (!raw_video_size && stream_input_read_probe(&stream_input) != 0) {
+            fprintf(stderr, "Error: No data on input stream: %s\n", filename);
+            stream_input_close(&stream_input);
+            return 1;
+        }
+    }
+
+    if (build_index) {
+        return build_sidecar_index(filename);
+    }
+
+    if (live_mode) {
+        // A live source has no end to loop from, nothing to index, and plays at the rate it arrives
+        loop_playback = false;
+        use_sidecar_index = false;
+        playback_speed = 1.0;
+    }
 
-    // Check if the input is a video file
-    if (is_video_file(filename)) {
+    // Check if the input is a video file; live sources are often URLs or devices without a video extension.
+    // A pipe holds a still image if stb recognises its header, otherwise it goes to the demuxer.
+    // A WebP file is a still image unless its header marks it animated (animated WebP needs FFmpeg 8 to decode).
+    bool stream_is_image = stream && !raw_video_size &&
+                           stbi_info_from_memory(stream_input.probe_data, (int)stream_input.probe_size, NULL, NULL, NULL);
+    const char *extension = strrchr(filename, '.');
+    int webp_width, webp_height;
+    bool animated_webp = false;
+    if (!stream && !live_mode && !raw_video_size && extension && strcasecmp(extension, ".webp") == 0 &&
+        webp_file_info(filename, &webp_width, &webp_height, &animated_webp) != 0) {
+        animated_webp = false;
+    }
+    if (live_mode || raw_video_size || animated_webp || (stream ? !stream_is_image : is_video_file(filename))) {
         process_video(filename);  // Call the simplified video processing function
         return 0;
     }
 
     // If it's not a video
-    int img_width, img_height, channels;
-
-    // Load the image
-    img = stbi_load(filename, &img_width, &img_height, &channels, 3);
-    if (!img) {
-        fprintf(stderr, "Error: Failed to load image: %s\n", filename);
-        return 1;
+    int img_width, img_height;
+
+    // Load the image; a piped image is read into memory first since stb needs to seek.
+    // GIFs are read into memory too, and play as animations when they have more than one frame.
+    uint8_t *data = NULL;
+    size_t data_size = 0;
+    if (stream) {
+        data = stream_input_read_all(&stream_input, &data_size);
+        stream_input_close(&stream_input);
+    } else if (extension && strcasecmp(extension, ".gif") == 0) {
+        data = read_file(filename, &data_size);
     }
 
-    // Initialize cached pixel array
-    cached_img = (CachedPixel *)malloc(img_width * img_height * sizeof(CachedPixel));
-    if (!cached_img) {
-        fprintf(stderr, "Error: Failed to cache grayscale values.\n");
-        stbi_image_free(img);
+    // Read just the header first, so a file that is not an image fails before any prompt
+    int source_width, source_height;
+    if (!still_image_info(filename, data, data_size, &source_width, &source_height)) {
+        fprintf(stderr, "Error: Failed to load image: %s\n", filename);
+        free(data);
         return 1;
     }
 
-    cache_grayscale_values(img, img_width, img_height, cached_img);
+    // Output files for an image piped to stdin are named after stdin
+    const char *output_name = strcmp(filename, "-") == 0 ? "stdin" : filename;
 
     // Let user choose character set for rendering
     char input_buffer[10];
@@ -1124,7 +5406,7 @@ int main(int argc, char *argv[]) {
     printf("3. Block characters ( ▁▂▃▄▅▆▇█ )\n");
     printf("Enter your choice (1/2/3): ");
 
-    if (fgets(input_buffer, sizeof(input_buffer), stdin) != NULL) {
+    if (read_prompt_input(input_buffer, sizeof(input_buffer)) != NULL) {
         choice = (int)strtol(input_buffer, NULL, 10);
     }
 
@@ -1148,8 +5430,7 @@ int main(int argc, char *argv[]) {
             break;
         default:
             fprintf(stderr, "Error: Invalid choice for character set.\n");
-            free(cached_img);
-            stbi_image_free(img);
+            free(data);
             return 1;
     }
 
@@ -1157,27 +5438,98 @@ int main(int argc, char *argv[]) {
     int output_mode = 0;
     printf("Choose output mode:\n");
     printf("1. Terminal\n");
-    printf("2. PNG\n");
+    printf("2. Image (%s)\n", image_encoders[output_format].name);
     printf("3. TXT\n");
     printf("Enter your choice (1/2/3): ");
 
-    if (fgets(input_buffer, sizeof(input_buffer), stdin) != NULL) {
+    if (read_prompt_input(input_buffer, sizeof(input_buffer)) != NULL) {
         output_mode = (int)strtol(input_buffer, NULL, 10);
     }
 
     if (output_mode != 1 && output_mode != 2 && output_mode != 3) {
         fprintf(stderr, "Error: Invalid output mode. Must be 1, 2, or 3.\n");
+        free(data);
         return 1;
     }
 
-    if (output_mode == 1) { // Terminal output mode
-        // Prepare terminal
-        int term_rows, term_cols;
+    // An animated GIF plays in the terminal; image and TXT output take its first frame like any other still
+    int gif_frames = output_mode == 1 && data ? gif_frame_count(data, data_size) : 0;
+    if (gif_frames >= 2 && (uint64_t)source_width * source_height * 4 * gif_frames > GIF_DECODE_MAX_BYTES) {
+        fprintf(stderr, "Warning: GIF too large to animate, showing its first frame.\n");
+    } else if (gif_frames >= 2 && play_animated_gif(data, data_size, char_set, char_set_size)) {
+        free(data);
+        return 0;
+    }
+
+    // In the terminal, a large image paints a quick preview first and the full decode then refines it in place
+    // A JPEG bound for the terminal is decoded only as large as the character grid needs, which is quick
+    // enough that it skips the preview
+    int term_rows = 0, term_cols = 0;
+    ViewRegion view;
+    bool previewed = false;
+    int lowres = 0;
+    if (output_mode == 1) {
         get_terminal_size(&term_rows, &term_cols);
         clear_terminal();
+        apply_initial_crop(source_width, source_height);
+        view = get_view_region(NULL);
+        if (!data && is_jpeg_file(filename)) {
+            lowres = jpeg_lowres_for_grid(source_width, source_height, &view, term_rows, term_cols);
+        }
+
+        int preview_width, preview_height;
+        CachedPixel *preview = NULL;
+        if (!data && lowres == 0 && (uint64_t)source_width * source_height >= PREVIEW_MIN_PIXELS) {
+            preview = load_still_preview(filename, source_width, source_height, &preview_width, &preview_height);
+        }
+        if (preview) {
+            MipPyramid preview_pyramid;
+            build_mip_pyramid(preview, preview_width, preview_height, &preview_pyramid);
+            render_ascii_art_terminal_still(&preview_pyramid, source_width, source_height, &view,
+                                            term_rows, term_cols, char_set, char_set_size, NULL, false);
+            free_mip_pyramid(&preview_pyramid);
+            free(preview);
+            previewed = true;
+        }
+    }
+
+    // File output renders once, so a full-size decode goes from RGB to character cells with the fused kernel and
+    // no cache is built. The terminal keeps the cache and its mip pyramid for zooming and panning.
+    int reduction = 1;  // Source pixels per cached pixel along each axis
+    uint8_t *rgb = NULL;
+    if (output_mode != 1 && (data || (uint64_t)source_width * source_height <= STILL_IMAGE_PIXEL_BUDGET)) {
+        int channels;
+        rgb = data ? stbi_load_from_memory(data, (int)data_size, &img_width, &img_height, &channels, 3)
+                   : stbi_load(filename, &img_width, &img_height, &channels, 3);
+    }
+    if (!rgb) {
+        cached_img = load_still_image(filename, data, data_size, source_width, source_height, lowres, &img_width, &img_height, &reduction);
+    }
+    free(data);
+    if (!cached_img && !rgb) {
+        fprintf(stderr, "Error: Failed to load image: %s\n", filename);
+        return 1;
+    }
+    if (reduction > 1 && output_mode != 1) {
+        printf("Reduced %dx%d to %dx%d while loading (%d:1)\n", source_width, source_height, img_width, img_height, reduction);
+    }
+
+    // Exact cell averages for file output from a reduced or fallback decode. The table takes 16 bytes per cached
+    // pixel, so it is only built for the one file render and never kept alongside the terminal's pyramid; without
+    // it (too large, or out of memory) files fall back to one pixel per cell
+    SummedAreaTable area_table = {0};
+    if (cached_img && output_mode != 1) {
+        build_summed_area_table(cached_img, img_width, img_height, &area_table);
+    }
 
-        // Initial render
-        render_ascii_art_terminal(cached_img, img_width, img_height, term_rows, term_cols, char_set, char_set_size, NULL);
+    if (output_mode == 1) { // Terminal output mode
+        // Resizes and zooms re-render from the pyramid level nearest the character grid
+        MipPyramid pyramid;
+        build_mip_pyramid(cached_img, img_width, img_height, &pyramid);
+
+        // Initial render; over a preview, only the cells the full image changes are repainted
+        render_ascii_art_terminal_still(&pyramid, source_width, source_height, &view,
+                                        term_rows, term_cols, char_set, char_set_size, NULL, previewed);
 
         // Set up for resizing
         struct sigaction sa;
@@ -1192,9 +5544,12 @@ int main(int argc, char *argv[]) {
             if (resized) {
                 // Clear the terminal only when the terminal is resized
                 clear_terminal();
-                // Re-render
+                // Re-render, decoding a reduced JPEG again if the larger grid needs more pixels
                 get_terminal_size(&term_rows, &term_cols);
-                render_ascii_art_terminal(cached_img, img_width, img_height, term_rows, term_cols, char_set, char_set_size, NULL);
+                refine_jpeg_decode(filename, source_width, source_height, &view, term_rows, term_cols, &lowres,
+                                   &cached_img, &img_width, &img_height, &pyramid);
+                render_ascii_art_terminal_still(&pyramid, source_width, source_height, &view,
+                                                term_rows, term_cols, char_set, char_set_size, NULL, false);
                 resized = false;
             }
 
@@ -1210,14 +5565,26 @@ int main(int argc, char *argv[]) {
             int retval = select(STDIN_FILENO + 1, &readfds, NULL, NULL, &timeout);
             if (retval > 0) {
                 char c;
-                if (read(STDIN_FILENO, &c, 1) > 0 && c == 'q') {
-                    break;
+                if (read(STDIN_FILENO, &c, 1) > 0) {
+                    if (c == 'q') {
+                        break;
+                    }
+                    if (handle_view_key(c)) {
+                        // Zoom/pan: re-render just the new region, repainting only the cells that change
+                        view = get_view_region(NULL);
+                        refine_jpeg_decode(filename, source_width, source_height, &view, term_rows, term_cols, &lowres,
+                                           &cached_img, &img_width, &img_height, &pyramid);
+                        render_ascii_art_terminal_still(&pyramid, source_width, source_height, &view,
+                                                        term_rows, term_cols, char_set, char_set_size, NULL, true);
+                    }
                 }
             }
         }
 
+        free_mip_pyramid(&pyramid);
         reset_input_mode();
         print_memory_usage();
+        print_time_to_first_frame();
     } else if (output_mode == 2) {  // File output mode
         // Profiling
         clock_t start_time = clock();
@@ -1226,13 +5593,13 @@ int main(int argc, char *argv[]) {
         float scale_factor = 1;
         printf("Enter a scale factor (e.g., 0.5 for half size, 1 for original size, 2 for double size): ");
 
-        if (fgets(input_buffer, sizeof(input_buffer), stdin) != NULL) {
+        if (read_prompt_input(input_buffer, sizeof(input_buffer)) != NULL) {
             scale_factor = strtof(input_buffer, NULL);
         }
 
         // Generate the output filename
         char output_filename[256];
-        generate_output_filename(filename, output_filename, scale_factor, "png");
+        generate_output_filename(output_name, output_filename, scale_factor, image_encoders[output_format].name);
 
         // Load the font
         init_font(FONT_PATH);
@@ -1240,29 +5607,33 @@ int main(int argc, char *argv[]) {
         if (scale_factor <= 0) {
             fprintf(stderr, "Error: Invalid scale factor. Must be greater than 0.\n");
             free(cached_img);
-            stbi_image_free(img);
+            stbi_image_free(rgb);
             return 1;
         }
 
-        render_ascii_art_file_scaled(cached_img, img_width, img_height, char_set, char_set_size, output_filename, scale_factor, FONT_SIZE);
+        // A reduced image covers the same output area at a proportionally larger scale
+        int render_status = render_ascii_art_file_scaled(rgb, cached_img, &area_table, img_width, img_height, char_set,
+                                                         char_set_size, output_filename, scale_factor * reduction, FONT_SIZE);
 
         // Profiling
         clock_t end_time = clock();
         double file_render_time = (double)(end_time - start_time) / CLOCKS_PER_SEC;
         printf("File render time: %.2f seconds\n", file_render_time);
-        printf("ASCII art saved to file: %s\n", output_filename);
+        if (render_status == 0) {
+            printf("ASCII art saved to file: %s\n", output_filename);
+        }
         print_memory_usage();
+        print_time_to_first_frame();
     } else {
         char output_filename[256];
-        generate_output_filename(filename, output_filename, 1, "txt");
+        generate_output_filename(output_name, output_filename, 1, "txt");
 
-        int term_rows = 0;
-        int term_cols = 0;
         get_terminal_size(&term_rows, &term_cols);
 
-        render_ascii_art_file_txt(cached_img, img_width, img_height, char_set, char_set_size, output_filename,
+        render_ascii_art_file_txt(rgb, cached_img, &area_table, img_width, img_height, char_set, char_set_size, output_filename,
                                   term_rows, term_cols);
         print_memory_usage();
+        print_time_to_first_frame();
     }
 
     // Show the cursor before exiting
@@ -1270,8 +5641,9 @@ int main(int argc, char *argv[]) {
     fflush(stdout);
 
     // Free memory
+    free_summed_area_table(&area_table);
     free(cached_img);
-    stbi_image_free(img);
+    stbi_image_free(rgb);
 
     return 0;
 }